@@ -0,0 +1,22 @@
+#ifndef _MEMSTAT_H_
+#define _MEMSTAT_H_
+
+// System-wide memory statistics for memstat().
+// Both the kernel and user programs use this header file.
+//
+// Heap pages reserved by sbrk() are zero-filled on demand.  Until
+// one is written, reading it maps a single shared zero page (or,
+// for a whole 4M-aligned region, a shared zero huge page) instead
+// of a private page, so each such page is one physical page saved.
+//
+// Once ksmctl() turns it on, a kernel process also merges user
+// pages with identical contents into one shared copy-on-write frame.
+
+struct memstat {
+  uint zeropages;  // user pages now mapped to the shared zero pages
+  uint ksmshared;  // frames shared by page merging
+  uint ksmsaved;   // pages mapped to those beyond one each: pages saved
+  uint ksmscans;   // passes of the merging scan over all processes
+};
+
+#endif // _MEMSTAT_H_
@@ -0,0 +1,11 @@
+#ifndef _PAGECTL_H_
+#define _PAGECTL_H_
+
+// Operations for pagectl(addr, op), a debugging aid that works on
+// the frame backing a page of the caller through the reverse map.
+// Both the kernel and user programs use this header file.
+
+#define PAGE_MOVE  1  // copy the frame to a new one and map that instead
+#define PAGE_DROP  2  // unmap the frame everywhere and free it
+
+#endif // _PAGECTL_H_
@@ -6,14 +6,36 @@
 #define NPROC        64  // maximum number of processes
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
+#define HZ          100  // timer ticks per second
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
 #define NBUF         10  // size of disk block cache
 #define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
+#define PHYSTOP 0x40000000 // use phys mem up to here at most (see memmap.c)
+
+// The kernel sees physical memory at KERNBASE (make KERNBASE=...,
+// see kernel/makefile.mk).  By default it is identity-mapped above a
+// 16M user address space; otherwise user memory is all of 0..KERNBASE.
+#ifndef KERNBASE
+#define KERNBASE 0
+#endif
+#if KERNBASE
+#define USERTOP  KERNBASE  // end of user address space
+#define KERNLINK (KERNBASE+0x100000)  // where the kernel is linked
+#else
 #define USERTOP  0x1000000 // end of user address space
-#define PHYSTOP  0xe000000 // use phys mem up to here as free pool
+#define KERNLINK 0x1080000 // where the kernel is linked
+#endif
+#define VDSO     0xFD000000  // the vDSO page (vdso.h), below the devices
+#if KERNBASE % 0x400000 || (KERNBASE && KERNBASE < 0x4000000) || \
+    KERNBASE + PHYSTOP > VDSO
+#error "KERNBASE must be a multiple of 4M from 64M up, below the vDSO"
+#endif
 #define MAXARG       32  // max exec arguments
+#define SWAPDEV       0  // disk holding the swap area (after the boot image)
+#define SWAPSTART 10000  // first sector of the swap area
+#define NSWAPPG    8192  // pages of swap space
 
 #endif // _PARAM_H_
@@ -0,0 +1,29 @@
+#ifndef _RLIMIT_H_
+#define _RLIMIT_H_
+
+// Memory limits for setrlimit() and getrlimit().
+// Both the kernel and user programs use this header file.
+//
+// Memory is counted in 4K pages -- resident, swapped out, or
+// reserved by sbrk() and not yet touched (see memstat.h); a huge
+// page counts as 1024 pages and as one huge page.  A process's own
+// limits are inherited by the children it forks.  A tree limit
+// covers the process that sets it together with the processes it
+// forks afterwards, and their children, and nests inside any tree
+// limit already in force.  Limits can only be lowered, except that
+// a process may start a new, nested tree limit at any value.
+
+#define RLIMIT_PAGES          0  // pages of this process
+#define RLIMIT_HUGEPAGES      1  // huge pages of this process
+#define RLIMIT_TREEPAGES      2  // pages of this process tree
+#define RLIMIT_TREEHUGEPAGES  3  // huge pages of this process tree
+#define RLIM_NLIMITS          4
+
+#define RLIM_INFINITY  0xffffffff
+
+struct rlimit {
+  uint limit;  // RLIM_INFINITY if none
+  uint use;    // currently charged against the limit
+};
+
+#endif // _RLIMIT_H_
@@ -0,0 +1,29 @@
+#ifndef _SCHEDSTAT_H_
+#define _SCHEDSTAT_H_
+
+// Scheduler statistics for schedstat().
+// Both the kernel and user programs use this header file.
+//
+// Processes run at one of NMLFQ priority levels, 0 the highest.  A
+// process that uses up its time slice at a level moves down to the
+// next, and every so often all of them are boosted back up to their
+// nice() level.
+//
+// Under the fair scheduling class, chosen at boot, processes instead
+// get CPU time in proportion to their setweight() weights, and run at
+// their nice() level throughout.
+
+#define NMLFQ 4  // priority levels
+
+struct schedstat {
+  uint runs[NMLFQ];       // times a process was picked at each level
+  uint ticks[NMLFQ];      // timer ticks spent running at each level
+  uint demotions[NMLFQ];  // processes moved down from each level
+  uint boosts;            // times all processes were moved back up
+  uint steals;            // processes taken from another CPU's queue
+  uint fair;              // 1 under the fair class, 0 under MLFQ
+  uint ncpu;              // CPUs running
+  uint idle[NCPU];        // ticks each CPU had nothing to run (param.h)
+};
+
+#endif // _SCHEDSTAT_H_
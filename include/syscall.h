@@ -25,5 +25,22 @@
 #define SYS_uptime 21
 #define SYS_getnextpid 22
 #define SYS_getprocstate 23
+#define SYS_clone  24
+#define SYS_join   25
+#define SYS_futex_wait 26
+#define SYS_futex_wake 27
+#define SYS_userfault 28
+#define SYS_userfault_copy 29
+#define SYS_setrlimit 30
+#define SYS_getrlimit 31
+#define SYS_memstat 32
+#define SYS_ksmctl 33
+#define SYS_hugeheap 34
+#define SYS_nice 35
+#define SYS_schedstat 36
+#define SYS_setweight 37
+#define SYS_nanosleep 38
+#define SYS_clock_gettime 39
+#define SYS_pagectl 40
 
 #endif // _SYSCALL_H_
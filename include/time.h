@@ -0,0 +1,20 @@
+#ifndef _TIME_H_
+#define _TIME_H_
+
+// Time for nanosleep() and clock_gettime().
+// Both the kernel and user programs use this header file.
+//
+// The kernel sleeps to the microsecond in tickless mode, and rounds
+// up to whole timer ticks (1/HZ second) otherwise.  Its clocks count
+// from boot off the calibrated TSC; since xv6 never suspends,
+// CLOCK_MONOTONIC and CLOCK_BOOTTIME are the same clock.
+
+#define CLOCK_MONOTONIC  1
+#define CLOCK_BOOTTIME   7
+
+struct timespec {
+  uint tv_sec;
+  uint tv_nsec;   // below 1000000000
+};
+
+#endif // _TIME_H_
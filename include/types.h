@@ -6,7 +6,14 @@
 typedef unsigned short ushort;
 typedef unsigned char  uchar;
 typedef unsigned int   uint;
+typedef unsigned long long uint64;
+#ifdef PAE
+typedef uint64 pde_t;   // PAE page table entries are 64 bits wide
+typedef uint64 pte_t;
+#else
 typedef uint pde_t;
+typedef uint pte_t;
+#endif
 #ifndef NULL
 #define NULL (0)
 #endif
@@ -0,0 +1,15 @@
+#ifndef _USERFAULT_H_
+#define _USERFAULT_H_
+
+// Fault notification read from a userfault file descriptor.
+// Both the kernel and user programs use this header file.
+
+#define UFFD_WRITE  0x1  // the faulting access was a write
+
+struct uffdmsg {
+  uint addr;   // page-aligned faulting address
+  uint flags;  // UFFD_*
+  int pid;     // faulting thread
+};
+
+#endif // _USERFAULT_H_
@@ -0,0 +1,26 @@
+#ifndef _VDSO_H_
+#define _VDSO_H_
+
+// The vDSO page, which the kernel keeps up to date and every user
+// program can read at VDSO (include/param.h) without a system call.
+// Both the kernel and user programs use this header file; include
+// param.h first.
+//
+// A user program's %fs selects its CPU's entry in cpu[], whichever
+// CPU it runs on, so %fs:0 is the CPU number and %fs:4 the pid of
+// the process reading it.
+
+struct vdsocpu {
+  uint cpu;                // index of this CPU
+  uint pid;                // process running on it
+};
+
+struct vdso {
+  volatile uint ticks;     // as uptime() returns
+  uint tsckhz;             // TSC counts per millisecond
+  uint64 tscboot;          // TSC at boot
+  uint nsmult, nsshift;    // ns since boot: (TSC - tscboot) * nsmult >> nsshift
+  struct vdsocpu cpu[NCPU];
+};
+
+#endif // _VDSO_H_
@@ -50,6 +50,73 @@ stosb(void *addr, int data, int cnt)
                "memory", "cc");
 }
 
+static inline void
+stosl(void *addr, int data, int cnt)
+{
+  asm volatile("cld; rep stosl" :
+               "=D" (addr), "=c" (cnt) :
+               "0" (addr), "1" (cnt), "a" (data) :
+               "memory", "cc");
+}
+
+static inline void
+movsb(void *dst, const void *src, int cnt)
+{
+  asm volatile("cld; rep movsb" :
+               "=D" (dst), "=S" (src), "=c" (cnt) :
+               "0" (dst), "1" (src), "2" (cnt) :
+               "memory", "cc");
+}
+
+static inline void
+movsl(void *dst, const void *src, int cnt)
+{
+  asm volatile("cld; rep movsl" :
+               "=D" (dst), "=S" (src), "=c" (cnt) :
+               "0" (dst), "1" (src), "2" (cnt) :
+               "memory", "cc");
+}
+
+static inline void
+cpuid(uint op, uint *a, uint *b, uint *c, uint *d)
+{
+  asm volatile("cpuid" :
+               "=a" (*a), "=b" (*b), "=c" (*c), "=d" (*d) :
+               "0" (op), "2" (0));
+}
+
+static inline void
+wrmsr(uint msr, uint64 val)
+{
+  asm volatile("wrmsr" : : "c" (msr), "A" (val));
+}
+
+static inline void
+fxsave(void *p)
+{
+  asm volatile("fxsave (%0)" : : "r" (p) : "memory");
+}
+
+static inline void
+fxrstor(void *p)
+{
+  asm volatile("fxrstor (%0)" : : "r" (p));
+}
+
+static inline void
+sfence(void)
+{
+  asm volatile("sfence" : : : "memory");
+}
+
+static inline uint64
+rdtsc(void)
+{
+  uint64 val;
+  asm volatile("rdtsc" : "=A" (val));
+  return val;
+}
+
 struct segdesc;
 
 static inline void
@@ -139,6 +206,33 @@ xchg(volatile uint *addr, uint newval)
   return result;
 }
 
+// Atomically replace *addr with newval if it equals oldval.
+// Returns the value *addr held before.
+static inline uint
+cmpxchg(volatile uint *addr, uint oldval, uint newval)
+{
+  uint result;
+
+  asm volatile("lock; cmpxchgl %2, %0" :
+               "+m" (*addr), "=a" (result) :
+               "r" (newval), "1" (oldval) :
+               "cc");
+  return result;
+}
+
+// cmpxchg() for a 64-bit *addr, such as a PAE page table entry.
+static inline uint64
+cmpxchg64(volatile uint64 *addr, uint64 oldval, uint64 newval)
+{
+  uint64 result;
+
+  asm volatile("lock; cmpxchg8b %1" :
+               "=A" (result), "+m" (*addr) :
+               "b" ((uint)newval), "c" ((uint)(newval >> 32)), "0" (oldval) :
+               "cc");
+  return result;
+}
+
 static inline void
 lcr0(uint val)
 {
@@ -8,6 +8,7 @@
 #include "types.h"
 #include "elf.h"
 #include "x86.h"
+#include "param.h"
 
 #define SECTSIZE  512
 
@@ -34,7 +35,7 @@ bootmain(void)
   ph = (struct proghdr*)((uchar*)elf + elf->phoff);
   eph = ph + elf->phnum;
   for(; ph < eph; ph++){
-    va = (uchar*)ph->va;
+    va = (uchar*)(ph->va - KERNBASE);  // the physical address
     readseg(va, ph->filesz, ph->offset);
     if(ph->memsz > ph->filesz)
       stosb(va + ph->filesz, 0, ph->memsz - ph->filesz);
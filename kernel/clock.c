@@ -0,0 +1,350 @@
+// The clock: timer interrupts, ticks, nanosleep() and clock_gettime().
+//
+// lapicinit() measures the local APIC timer against the PIT and has
+// each CPU's timer interrupt HZ times a second.  On every tick CPU 0
+// advances ticks and runs the kernel timers (ktimer.c), and each CPU
+// charges its running process's time slice.
+//
+// In tickless mode (make TICKLESS=1, or tickless=on on a multiboot
+// command line; tickless=off turns it off) the timers are one-shot
+// instead, and clockarm() programs each for the next thing due on
+// its CPU: the next tick while the CPU is busy, else the first
+// nanosleep() to end and, on CPU 0, the next kernel timer.  An idle
+// CPU then stays halted until there is work, rather than waking HZ
+// times a second.  CPU 0 keeps ticking while any other CPU is busy,
+// since their processes need ticks to move; a CPU that stops idling
+// while CPU 0 is not ticking sends it an IPI.  Each CPU keeps time in
+// timer counts since it started (clocknow()), and catches up on the
+// ticks it slept through when it wakes.  nanosleep() deadlines are
+// counts on the sleeper's CPU, so it sleeps to the microsecond;
+// without tickless mode it rounds up to whole ticks.
+//
+// clocknsec() reads the time since boot in nanoseconds off the TSC,
+// which timercalibrate() timed against the PIT.  The TSCs of all CPUs
+// are taken to run in step, as invariant TSCs and QEMU's do.  The
+// conversion is a multiply and shift, which the vDSO page (vdso.c)
+// publishes along with ticks so that user programs get the same
+// time without a system call.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "x86.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "traps.h"
+#include "time.h"
+#include "vdso.h"
+
+#define NSSHIFT 24             // see nsmult
+
+// A process in nanosleep(), on the list of the CPU it started on.
+struct nanosleeper {
+  uint64 deadline;             // in that CPU's counts
+  struct proc *p;
+  struct nanosleeper *next;
+};
+
+static struct clock {
+  struct spinlock lock;        // guards all but base and armed
+  uint64 base;                 // counts since start, as of the last arm
+  uint armed;                  // counts the timer was last armed for
+  uint64 nexttick;             // count at which the next tick is due
+  struct nanosleeper *sleepers;  // sorted by deadline
+} clocks[NCPU];
+
+int tickless;                  // one-shot timers; see above
+static uint tickcount;         // timer counts per tick
+static uint uscount;           // timer counts per microsecond
+static volatile uint nohz;     // CPU 0 is idle and not ticking
+static uint nsmult;            // ns = TSC counts * nsmult >> NSSHIFT
+
+// n / d, with n % d in *r, without 64-bit division from libgcc.
+static uint64
+div64(uint64 n, uint d, uint *r)
+{
+  uint hi, lo;
+
+  hi = (uint)(n >> 32) / d;
+  asm("divl %4" : "=a" (lo), "=d" (*r)
+                : "a" ((uint)n), "d" ((uint)(n >> 32) % d), "rm" (d));
+  return (uint64)hi << 32 | lo;
+}
+
+void
+clockinit(void)
+{
+  char *s;
+  uint r;
+  int i;
+
+  for(i = 0; i < NCPU; i++)
+    initlock(&clocks[i].lock, "clock");
+#ifdef TICKLESS
+  tickless = 1;
+#endif
+  for(s = bootcmdline(); *s; s++){
+    if(strncmp(s, "tickless=on", 11) == 0)
+      tickless = 1;
+    else if(strncmp(s, "tickless=off", 12) == 0)
+      tickless = 0;
+  }
+  if(!lapic || lapicfreq < 1000000)
+    tickless = 0;
+  tickcount = lapicfreq / HZ;
+  uscount = lapicfreq / 1000000;
+  if(tsckhz == 0)
+    timercalibrate();
+  // nsmult fits 32 bits for TSCs from 4 MHz up.
+  if(tsckhz >= 4000)
+    nsmult = div64((uint64)1000000 << NSSHIFT, tsckhz, &r);
+  vdso->tsckhz = tsckhz;
+  vdso->tscboot = tscboot;
+  vdso->nsmult = nsmult;
+  vdso->nsshift = NSSHIFT;
+  cprintf("clock: %d MHz TSC", tsckhz / 1000);
+  if(lapic)
+    cprintf(", %d MHz timer, %s", lapicfreq / 1000000,
+            tickless ? "tickless" : "periodic");
+  cprintf("\n");
+}
+
+// Nanoseconds since boot, or 0 before the TSC has been calibrated.
+uint64
+clocknsec(void)
+{
+  uint64 d;
+
+  d = rdtsc() - tscboot;
+  return ((uint64)(uint)d * nsmult >> NSSHIFT) +
+         ((uint64)(uint)(d >> 32) * nsmult << (32 - NSSHIFT));
+}
+
+// Read clock clk into *ts.  Returns -1 for an unknown clock.
+int
+clockgettime(int clk, struct timespec *ts)
+{
+  uint64 sec;
+  uint nsec;
+
+  if(clk != CLOCK_MONOTONIC && clk != CLOCK_BOOTTIME)
+    return -1;
+  sec = div64(clocknsec(), 1000000000, &nsec);
+  ts->tv_sec = sec;
+  ts->tv_nsec = nsec;
+  return 0;
+}
+
+// Counts since this CPU started.  Interrupts must be off.
+static uint64
+clocknow(struct clock *c)
+{
+  return c->base + (c->armed - lapiccount());
+}
+
+// Program this CPU's timer for its next event; busy says it has a
+// process to run and so needs its next tick.  Caller holds c->lock.
+static void
+clockarm(struct clock *c, int busy)
+{
+  uint64 now, next, t;
+  uint when;
+  int i;
+
+  now = clocknow(c);
+  next = now + 0xFFFFFFFF;     // as far as the timer reaches
+  if(busy)
+    next = c->nexttick;
+  else if(cpu->id == 0){
+    // Stop ticking only if every other CPU is idle.  nohz is set
+    // before their idle flags are looked at, and clockwake() clears a
+    // CPU's flag before looking at nohz, so one of the two sees the
+    // other.
+    xchg(&nohz, 1);
+    for(i = 1; i < ncpu; i++)
+      if(cpus[i].booted && !cpus[i].idle)
+        break;
+    if(i < ncpu){
+      nohz = 0;
+      next = c->nexttick;
+    } else if(ktimernext(&when)){
+      t = c->nexttick;
+      if((int)(when - ticks) > 1)
+        t += (uint64)(when - ticks - 1) * tickcount;
+      if(t < next)
+        next = t;
+    }
+  }
+  if(cpu->id == 0 && next == c->nexttick)
+    nohz = 0;
+  if(c->sleepers && c->sleepers->deadline < next)
+    next = c->sleepers->deadline;
+  when = next > now ? next - now : 1;
+  c->base = now;
+  c->armed = when;
+  lapiconeshot(when);
+}
+
+// Count the ticks due by now on this CPU, as idle ones if idle, end
+// the nanosleep()s that are due, and on CPU 0 advance ticks.  Returns
+// the number of ticks.  Caller holds c->lock.
+static int
+clockupdate(struct clock *c, int idle)
+{
+  struct nanosleeper *s;
+  uint64 now;
+  int n;
+
+  now = clocknow(c);
+  for(n = 0; now >= c->nexttick; n++)
+    c->nexttick += tickcount;
+  if(idle)
+    cpu->idleticks += n;
+  while((s = c->sleepers) != 0 && s->deadline <= now){
+    c->sleepers = s->next;
+    sleepexpire(s->p);
+  }
+  if(cpu->id == 0 && n > 0){
+    acquire(&tickslock);
+    ticks += n;
+    vdso->ticks = ticks;
+    release(&tickslock);
+    ktimertick();
+    schedboost();
+  }
+  return n;
+}
+
+// Start this CPU's clock.  Interrupts must be off.
+void
+clockstart(void)
+{
+  struct clock *c;
+
+  if(!tickless)
+    return;
+  c = &clocks[cpu - cpus];
+  acquire(&c->lock);
+  c->base = 0;
+  c->armed = 0;
+  c->nexttick = tickcount;
+  clockarm(c, 1);
+  release(&c->lock);
+}
+
+// The timer interrupt.  Returns the number of ticks that have passed
+// on this CPU, for time slices.
+int
+clockintr(void)
+{
+  struct clock *c;
+  int n;
+
+  if(!tickless){
+    if(proc == 0)
+      cpu->idleticks++;
+    if(cpu->id == 0){
+      acquire(&tickslock);
+      ticks++;
+      vdso->ticks = ticks;
+      release(&tickslock);
+      ktimertick();
+      schedboost();
+    }
+    return 1;
+  }
+  c = &clocks[cpu - cpus];
+  acquire(&c->lock);
+  n = clockupdate(c, cpu->idle);
+  clockarm(c, !cpu->idle);
+  release(&c->lock);
+  return n;
+}
+
+// This CPU is about to halt in idle(): arm its timer for only what
+// it has to do.  Interrupts are off.
+void
+clockidle(void)
+{
+  struct clock *c;
+
+  if(!tickless)
+    return;
+  c = &clocks[cpu - cpus];
+  acquire(&c->lock);
+  clockarm(c, 0);
+  release(&c->lock);
+}
+
+// This CPU has left idle(): count the ticks it was halted for and
+// start ticking again, and CPU 0 too.  Interrupts are off.
+void
+clockwake(void)
+{
+  struct clock *c;
+
+  if(!tickless)
+    return;
+  c = &clocks[cpu - cpus];
+  acquire(&c->lock);
+  clockupdate(c, 1);
+  clockarm(c, 1);
+  release(&c->lock);
+  if(cpu->id != 0 && xchg(&nohz, 0))
+    lapicipi(cpus[0].id, T_IRQ0 + IRQ_RESCHED);
+}
+
+// Sleep for sec seconds and nsec nanoseconds.  Returns -1 if killed.
+int
+nanosleep(uint sec, uint nsec)
+{
+  struct nanosleeper s, **pp;
+  struct clock *c;
+  uint n, ticks0;
+  int r;
+
+  if(!tickless){
+    n = sec * HZ + (nsec + 1000000000/HZ - 1) / (1000000000/HZ);
+    acquire(&tickslock);
+    ticks0 = ticks;
+    while(ticks - ticks0 < n){
+      if(proc->killed){
+        release(&tickslock);
+        return -1;
+      }
+      proc->swappable = 1;
+      sleeptimeout(&ticks0, &tickslock, n - (ticks - ticks0));
+      proc->swappable = 0;
+    }
+    release(&tickslock);
+    return 0;
+  }
+
+  pushcli();
+  c = &clocks[cpu - cpus];
+  acquire(&c->lock);
+  popcli();
+  s.deadline = clocknow(c) +
+    ((uint64)sec * 1000000 + (nsec + 999) / 1000) * uscount;
+  s.p = proc;
+  for(pp = &c->sleepers; *pp && (*pp)->deadline <= s.deadline; pp = &(*pp)->next)
+    ;
+  s.next = *pp;
+  *pp = &s;
+  if(c->sleepers == &s)
+    clockarm(c, 1);
+  // Nothing wakes &s; the timer ends the sleep, or kill().
+  proc->swappable = 1;
+  sleeptimed(&s, &c->lock);
+  proc->swappable = 0;
+  r = proc->timedout ? 0 : -1;
+  if(!proc->timedout){
+    for(pp = &c->sleepers; *pp != &s; pp = &(*pp)->next)
+      ;
+    *pp = s.next;
+  }
+  proc->timedout = 0;
+  release(&c->lock);
+  return r;
+}
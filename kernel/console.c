@@ -118,7 +118,12 @@ panic(char *s)
 
 #define BACKSPACE 0x100
 #define CRTPORT 0x3d4
-static uint *crt = (uint*)( 0xb8000 + 0x1080000 - 0xA0000);  // CGA memory
+#if KERNBASE
+static uint *crt = (uint*)KADDR(0xb8000);  // CGA memory
+#else
+// Below USERTOP, so vm.c maps the I/O hole, 0xA0000 on, at USERTOP.
+static uint *crt = (uint*)(USERTOP + 0xb8000 - 0xA0000);  // CGA memory
+#endif
 
 static void
 cgaputc(int c)
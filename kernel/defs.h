@@ -9,6 +9,13 @@ struct pipe;
 struct proc;
 struct spinlock;
 struct stat;
+struct userfault;
+struct rlimit;
+struct memstat;
+struct schedstat;
+struct ktimer;
+struct timespec;
+struct vdso;
 
 // bio.c
 void            binit(void);
@@ -16,6 +23,17 @@ struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
 
+// clock.c
+extern int      tickless;
+void            clockinit(void);
+void            clockstart(void);
+int             clockintr(void);
+void            clockidle(void);
+void            clockwake(void);
+int             nanosleep(uint, uint);
+uint64          clocknsec(void);
+int             clockgettime(int, struct timespec*);
+
 // console.c
 void            consoleinit(void);
 void            cprintf(char*, ...);
@@ -34,6 +52,17 @@ int             fileread(struct file*, char*, int n);
 int             filestat(struct file*, struct stat*);
 int             filewrite(struct file*, char*, int n);
 
+// fpu.c
+extern int      fpusse2;
+void            fpuinit(void);
+void            fputrap(void);
+void            fpuleave(void);
+void            fpuenter(struct proc*);
+void            fpufork(struct proc*);
+void            fpureset(void);
+void            fpubegin(void);
+void            fpuend(void);
+
 // fs.c
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
@@ -52,6 +81,11 @@ int             readi(struct inode*, char*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
 
+// futex.c
+void            futexinit(void);
+int             futexwait(uint, int, int);
+int             futexwake(uint, int);
+
 // ide.c
 void            ideinit(void);
 void            ideintr(void);
@@ -67,20 +101,48 @@ char*           kalloc(void);
 void            kfree(char*);
 void            kinit(void);
 void*           buddy_alloc(uint);
+void            buddy_split(void*);
 void            print_allocator();
 
 
 // kbd.c
 void            kbdintr(void);
 
+// ksm.c
+void            ksminit(void);
+int             ksmctl(int, int);
+void            ksmstat(struct memstat*);
+void            ksmget(char*);
+void            ksmput(char*);
+int             ksmlast(char*);
+void            ksmd(void) __attribute__((noreturn));
+
+// ktimer.c
+void            ktimerinit(void);
+void            ktimeradd(struct ktimer*, uint, void(*)(void*), void*);
+int             ktimerdel(struct ktimer*);
+int             ktimernext(uint*);
+void            ktimertick(void);
+
 // lapic.c
 int             cpunum(void);
 extern volatile uint*    lapic;
+extern uint     lapicfreq;
+uint            lapiccount(void);
 void            lapiceoi(void);
+void            lapicipi(int, int);
 void            lapicinit(int);
+void            lapiconeshot(uint);
 void            lapicstartap(uchar, uint);
 void            microdelay(int);
 
+// memmap.c
+extern uint     physend;
+void            memmapinit(void);
+char*           bootcmdline(void);
+int             memusable(uint, uint);
+uint            memsize(void);
+
 // mp.c
 extern int      ismp;
 int             mpbcpu(void);
@@ -98,22 +160,63 @@ int             piperead(struct pipe*, char*, int);
 int             pipewrite(struct pipe*, char*, int);
 
 // proc.c
+int             clone(void(*)(void*), void*, void*);
 struct proc*    copyproc(struct proc*);
 void            exit(void);
 int             fork(void);
 int             growproc(int);
+int             growstack(uint, uint);
 int             kill(int);
+void            killthreads(pde_t*);
 void            pinit(void);
 void            procdump(void);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            sleep(void*, struct spinlock*);
+void            sleeptimed(void*, struct spinlock*);
+int             sleeptimeout(void*, struct spinlock*, uint);
+void            sleepexpire(void*);
 void            userinit(void);
 int             wait(void);
 void            wakeup(void*);
+void            wakeupone(void*);
 void            yield(void);
 int             getnextpid();
 int             getprocstate(int pid, char* state, int n);
+int             join(void**);
+pde_t*          swapvictim(int);
+int             swaplock(pde_t*);
+void            swapunlock(void);
+int             mergelock(pde_t*);
+int             mergealso(pde_t*);
+int             swapalso(pde_t*);
+void            kproc(char*, void(*)(void));
+int             schedtick(void);
+void            schedboost(void);
+int             nice(int);
+int             setweight(int);
+void            schedstat(struct schedstat*);
+
+// rmap.c
+void            rmapinit(void);
+void            rmaplock(void);
+void            rmapunlock(void);
+int             rmapadd(uint, pde_t*, uint);
+void            rmapdel(uint, pde_t*, uint);
+void            rmapsplit(uint, pde_t*, uint);
+pde_t*          rmapfirst(uint);
+int             rmapwalk(uint, int(*)(pde_t*, uint, void*), void*);
+void            rmapmove(uint, uint);
+void            rmapclear(uint);
+
+// swap.c
+void            swapinit(void);
+int             swapalloc(int);
+void            swapfree(int, int);
+void            swapread(int, char*, int);
+void            swapwrite(int, char*, int);
+int             swapbegin(void);
+void            swapend(void);
 
 // swtch.S
 void            swtch(struct context**, struct context*);
@@ -131,6 +234,7 @@ void            popcli(void);
 int             memcmp(const void*, const void*, uint);
 void*           memmove(void*, const void*, uint);
 void*           memset(void*, int, uint);
+void            membench(void);
 char*           safestrcpy(char*, const char*, int);
 int             strlen(const char*);
 int             strncmp(const char*, const char*, uint);
@@ -145,10 +249,14 @@ int             fetchstr(struct proc*, uint, char**);
 void            syscall(void);
 
 // timer.c
+extern uint     tsckhz;
+extern uint64   tscboot;
+void            timercalibrate(void);
 void            timerinit(void);
 
 // trap.c
 void            idtinit(void);
+void            sysenterinit(void);
 extern uint     ticks;
 void            tvinit(void);
 extern struct spinlock tickslock;
@@ -158,21 +266,54 @@ void            uartinit(void);
 void            uartintr(void);
 void            uartputc(int);
 
+// userfault.c
+void            userfaultinit(void);
+int             userfaultalloc(struct file**, uint, uint);
+void            userfaultclose(struct userfault*);
+int             userfaultread(struct userfault*, char*, int);
+int             userfaultcopy(struct userfault*, uint, char*, uint);
+int             userfaulthandle(uint, int);
+
+// vdso.c
+extern struct vdso *vdso;
+void            vdsoinit(void);
+
 // vm.c
 void            seginit(void);
 void            kvmalloc(void);
+void            kvmmapuser(uint, char*);
 void            vmenable(void);
 pde_t*          setupkvm(void);
+pde_t*          setupuvm(pde_t*);
 char*           uva2ka(pde_t*, char*);
+uint            uva2pa(pde_t*, uint);
 int             allocuvm(pde_t*, uint, uint);
+int             zerouvm(pde_t*, uint, uint);
 int             deallocuvm(pde_t*, uint, uint);
 void            freevm(pde_t*);
+void            vmshare(pde_t*);
+void            vmlock(pde_t*);
+void            vmunlock(pde_t*);
+int             vmunshare(pde_t*);
 void            inituvm(pde_t*, char*, uint);
 int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
-pde_t*          copyuvm(pde_t*, uint);
+pde_t*          copyuvm(pde_t*);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
+int             pagefault(uint, uint);
+int             prefault(uint, uint);
+int             swapout(void);
+int             vmsetlimit(pde_t*, int, uint);
+int             vmgetlimit(pde_t*, int, struct rlimit*);
+int             uvmunmap(pde_t*, uint, uint);
+int             uvmmap(pde_t*, uint, char*, uint);
+pte_t*          uvmpte(pde_t*, uint);
+int             setpte(pde_t*, uint, pte_t*, pte_t, pte_t);
+int             frameremap(char*, char*);
+int             frameunmap(char*);
+int             pagectl(uint, int);
+void            memstat(struct memstat*);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
@@ -28,7 +28,7 @@ exec(char *path, char **argv)
   if(elf.magic != ELF_MAGIC)
     goto bad;
 
-  if((pgdir = setupkvm()) == 0)
+  if((pgdir = setupuvm(proc->pgdir)) == 0)
     goto bad;
 
   // Load program into memory.
@@ -89,13 +89,22 @@ exec(char *path, char **argv)
       last = s+1;
   safestrcpy(proc->name, last, sizeof(proc->name));
 
-  // Commit to the user image.
+  // Commit to the user image.  Leave the old address space under
+  // its lock, so that other threads still in it do not set the new
+  // sz or stack.
   oldpgdir = proc->pgdir;
+  vmlock(oldpgdir);
   proc->pgdir = pgdir;
   proc->sz = sz;
+  proc->stack = (char*)(USERTOP-PGSIZE);
+  vmunlock(oldpgdir);
+  // The other threads of the old image go; this one leads the new.
+  killthreads(oldpgdir);
+  proc->ustack = 0;
   proc->tf->eip = elf.entry;  // main
   proc->tf->esp = sp;
-  proc->stack = (char*)(USERTOP-PGSIZE);
+  proc->tf->fs = (SEG_UCPU << 3) | DPL_USER;  // see vdso.c
+  fpureset();
  
   switchuvm(proc);
   freevm(oldpgdir);
@@ -69,6 +69,8 @@ fileclose(struct file *f)
     pipeclose(ff.pipe, ff.writable);
   else if(ff.type == FD_INODE)
     iput(ff.ip);
+  else if(ff.type == FD_USERFAULT)
+    userfaultclose(ff.uf);
 }
 
 // Get metadata about file f.
@@ -94,6 +96,8 @@ fileread(struct file *f, char *addr, int n)
     return -1;
   if(f->type == FD_PIPE)
     return piperead(f->pipe, addr, n);
+  if(f->type == FD_USERFAULT)
+    return userfaultread(f->uf, addr, n);
   if(f->type == FD_INODE){
     ilock(f->ip);
     if((r = readi(f->ip, addr, f->off, n)) > 0)
@@ -1,12 +1,13 @@
 #ifndef _FILE_H_
 #define _FILE_H_
 struct file {
-  enum { FD_NONE, FD_PIPE, FD_INODE } type;
+  enum { FD_NONE, FD_PIPE, FD_INODE, FD_USERFAULT } type;
   int ref; // reference count
   char readable;
   char writable;
   struct pipe *pipe;
   struct inode *ip;
+  struct userfault *uf;
   uint off;
 };
 
@@ -0,0 +1,146 @@
+// The x87/SSE unit.
+//
+// fpuinit() turns on SSE on each CPU that has it.  Each process has
+// its own FPU registers, switched lazily: CR0.TS is set unless the
+// current process's registers are loaded, so its first FPU or SSE
+// instruction traps (T_DEVICE) and fputrap() loads them.  A process
+// that used the FPU has its registers saved when it gives up the
+// CPU; one that did not costs nothing.  If it runs again on the
+// same CPU before anything else has used the FPU there, its
+// registers are still loaded and CR0.TS is cleared straight away.
+//
+// The kernel may use the SSE registers, for bulk copies in
+// string.c, between fpubegin() and fpuend().
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+
+// CPUID leaf 1 EDX feature bits.
+#define CPUID_FXSR  (1<<24)
+#define CPUID_SSE   (1<<25)
+#define CPUID_SSE2  (1<<26)
+
+#define MXCSR_DEFAULT 0x1F80  // all SSE exceptions masked
+
+int fpusse2;  // do the CPUs have SSE2?  Nothing here is done if not.
+
+// The registers a process starts with.
+static char fpuinitstate[512] __attribute__((aligned(16)));
+
+static inline void
+clts(void)
+{
+  asm volatile("clts");
+}
+
+static inline void
+stts(void)
+{
+  lcr0(rcr0() | CR0_TS);
+}
+
+// Run once at boot time on each CPU, before it copies memory.
+void
+fpuinit(void)
+{
+  uint a, b, c, d, mxcsr;
+
+  cpuid(1, &a, &b, &c, &d);
+  if((d & (CPUID_FXSR|CPUID_SSE|CPUID_SSE2)) != (CPUID_FXSR|CPUID_SSE|CPUID_SSE2))
+    return;
+  lcr0((rcr0() & ~(CR0_EM|CR0_TS)) | CR0_MP | CR0_NE);
+  lcr4(rcr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+  if(!fpusse2){
+    mxcsr = MXCSR_DEFAULT;
+    asm volatile("fninit; ldmxcsr %0" : : "m" (mxcsr));
+    fxsave(fpuinitstate);
+    memset(fpuinitstate + 32, 0, 512 - 32);  // x87 and SSE registers
+    fpusse2 = 1;
+  }
+  stts();
+}
+
+// The current process used the FPU for the first time since it got
+// the CPU.  Called from trap() with interrupts off.
+void
+fputrap(void)
+{
+  clts();
+  if(cpu->fpuowner != proc || proc->fpucpu != cpu - cpus){
+    fxrstor(proc->fpuused ? proc->fpu : fpuinitstate);
+    proc->fpuused = 1;
+    proc->fpucpu = cpu - cpus;
+    cpu->fpuowner = proc;
+  }
+}
+
+// The current process gives up the CPU (see sched()).
+void
+fpuleave(void)
+{
+  if(fpusse2 && !(rcr0() & CR0_TS)){
+    fxsave(proc->fpu);
+    stts();
+  }
+}
+
+// Process p gets the CPU (see scheduler()).
+void
+fpuenter(struct proc *p)
+{
+  if(cpu->fpuowner == p && p->fpucpu == cpu - cpus)
+    clts();
+}
+
+// Give child np a copy of the current process's registers.
+void
+fpufork(struct proc *np)
+{
+  if(!fpusse2)
+    return;
+  pushcli();
+  if(!(rcr0() & CR0_TS))
+    fxsave(proc->fpu);
+  popcli();
+  memmove(np->fpu, proc->fpu, sizeof(np->fpu));
+  np->fpuused = proc->fpuused;
+}
+
+// The current process starts a new program with fresh registers.
+void
+fpureset(void)
+{
+  if(!fpusse2)
+    return;
+  pushcli();
+  proc->fpuused = 0;
+  proc->fpucpu = -1;
+  if(cpu->fpuowner == proc)
+    cpu->fpuowner = 0;
+  stts();
+  popcli();
+}
+
+// Let the kernel use the SSE registers until fpuend().
+// Interrupts stay off meanwhile, so keep it short.
+void
+fpubegin(void)
+{
+  pushcli();
+  if(rcr0() & CR0_TS)
+    clts();
+  else
+    fxsave(proc->fpu);
+  cpu->fpuowner = 0;
+}
+
+void
+fpuend(void)
+{
+  stts();
+  popcli();
+}
@@ -273,7 +273,7 @@ iunlock(struct inode *ip)
 
   acquire(&icache.lock);
   ip->flags &= ~I_BUSY;
-  wakeup(ip);
+  wakeupone(ip);
   release(&icache.lock);
 }
 
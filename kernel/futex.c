@@ -0,0 +1,138 @@
+// Fast user-space mutexes.
+//
+// futexwait() puts the calling thread to sleep as long as the int at
+// a user address still holds an expected value; futexwake() wakes
+// threads waiting on an address.  User-space locks only make these
+// calls when they are contended (see user/uthread.c).
+//
+// Waiters are keyed by the physical address of the int, so threads
+// sharing a page directory and processes sharing a frame agree on
+// the key.  The int is faulted in for writing first, so a shared
+// zero page (see zerofault() in vm.c) is never taken as the key.
+// Keys hash into a fixed table of wait queues, each with
+// its own lock, so unrelated futexes do not contend.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+
+#define NFUTEXHASH 64
+
+// A sleeping thread, which sleeps on it.  Lives on the waiter's
+// kernel stack.
+struct futexwaiter {
+  uint key;                    // physical address waited on
+  int woken;                   // set by futexwake()
+  struct futexwaiter *next;
+};
+
+static struct {
+  struct spinlock lock;
+  struct futexwaiter *head;
+} futexq[NFUTEXHASH];
+
+void
+futexinit(void)
+{
+  int i;
+
+  for(i = 0; i < NFUTEXHASH; i++)
+    initlock(&futexq[i].lock, "futex");
+}
+
+static uint
+futexhash(uint key)
+{
+  return (key >> 2) % NFUTEXHASH;
+}
+
+// Remove w from its wait queue.  Caller holds the queue lock.
+static void
+futexunlink(uint h, struct futexwaiter *w)
+{
+  struct futexwaiter **pp;
+
+  for(pp = &futexq[h].head; *pp; pp = &(*pp)->next){
+    if(*pp == w){
+      *pp = w->next;
+      return;
+    }
+  }
+}
+
+// Sleep until woken by futexwake() on addr, as long as the int at
+// user address addr holds val.  timeout is in ticks; 0 waits
+// forever.  Returns 0 if woken, -1 if the value did not match, the
+// wait timed out or the process was killed.
+int
+futexwait(uint addr, int val, int timeout)
+{
+  struct futexwaiter w;
+  uint key, h, ticks0;
+
+  if(addr % 4 != 0 || prefault(addr, 4) < 0 ||
+     (key = uva2pa(proc->pgdir, addr)) == 0)
+    return -1;
+  h = futexhash(key);
+
+  acquire(&futexq[h].lock);
+  // Checking the value under the queue lock means a futexwake()
+  // issued after the user changed it cannot be missed.  key is
+  // physical; read the int through the kernel's mapping of it.
+  if(*(int*)KADDR(key) != val){
+    release(&futexq[h].lock);
+    return -1;
+  }
+  w.key = key;
+  w.woken = 0;
+  w.next = futexq[h].head;
+  futexq[h].head = &w;
+
+  ticks0 = ticks;
+  while(!w.woken){
+    if(proc->killed || (timeout > 0 && ticks - ticks0 >= timeout)){
+      futexunlink(h, &w);
+      break;
+    }
+    if(timeout > 0)
+      sleeptimeout(&w, &futexq[h].lock, timeout - (ticks - ticks0));
+    else
+      sleep(&w, &futexq[h].lock);
+  }
+  release(&futexq[h].lock);
+  return w.woken ? 0 : -1;
+}
+
+// Wake up to n threads waiting on user address addr.
+// Returns the number of threads woken, or -1 on a bad address.
+int
+futexwake(uint addr, int n)
+{
+  struct futexwaiter **pp, *w;
+  uint key, h;
+  int woken;
+
+  if(addr % 4 != 0 || prefault(addr, 4) < 0 ||
+     (key = uva2pa(proc->pgdir, addr)) == 0)
+    return -1;
+  h = futexhash(key);
+
+  woken = 0;
+  acquire(&futexq[h].lock);
+  for(pp = &futexq[h].head; *pp && woken < n; ){
+    w = *pp;
+    if(w->key != key){
+      pp = &w->next;
+      continue;
+    }
+    *pp = w->next;
+    w->woken = 1;
+    wakeup(w);
+    woken++;
+  }
+  release(&futexq[h].lock);
+  return woken;
+}
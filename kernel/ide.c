@@ -108,7 +108,7 @@ ideintr(void)
   // Wake process waiting for this buf.
   b->flags |= B_VALID;
   b->flags &= ~B_DIRTY;
-  wakeup(b);
+  wakeupone(&b->qnext);
   
   // Start disk on next buf in queue.
   if(idequeue != 0)
@@ -144,10 +144,11 @@ iderw(struct buf *b)
   if(idequeue == b)
     idestart(b);
   
-  // Wait for request to finish.
+  // Wait for request to finish.  Sleep on &b->qnext rather than
+  // b, on which bget() waits for the buffer itself.
   // Assuming will not sleep too long: ignore proc->killed.
   while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
-    sleep(b, &idelock);
+    sleep(&b->qnext, &idelock);
   }
 
   release(&idelock);
@@ -109,12 +109,17 @@ void clear_bit(char* arr, int index) {
 
 extern char end[]; // first address after kernel loaded from ELF file
 
+// The allocator manages the MAXSIZE blocks from heapstart to
+// heapend; its bitmaps go between end and heapstart.  Only the
+// pages that memusable() (memmap.c) allows are ever free.
+static uint heapstart, heapend;
+
 
 void
 print_allocator() {
     cprintf("===Allocator State===\n");
-    void* base = (void*)ROUNDUP((uint)end, MAXSIZE);  //the address of the first page
-    void* bounds = (void*) ROUNDDOWN((uint)PHYSTOP, MAXSIZE); //the byte after the last byte of the last page
+    void* base = (void*)heapstart;  //the address of the first page
+    void* bounds = (void*)heapend; //the byte after the last byte of the last page
     for(int i = 0; i < MAXORDER; i++) {
         cprintf("Free list for size %d (%d bytes):\n", i, BLOCKSIZE(i));
         list_print(free_area_list.free_areas[i].free_list);
@@ -142,11 +147,33 @@ print_allocator() {
 
 
 
+int get_index(void*, int);
+void buddy_free(void*);
+
+// Bytes of bitmaps needed to manage the blocks from base to bounds.
+static uint
+bitmapsize(uint base, uint bounds) {
+    uint n = 0;
+    for(int i = MAXSIZE; i >= 0; i--) {
+        unsigned int n_pages = (bounds - base) / (BLOCKSIZE(i));
+        uint n_chars = (n_pages + 7) >> 3;
+        n += (i != 0) ? 2 * n_chars : n_chars;
+    }
+    return n;
+}
+
 void
 buddy_init(void) {
     initlock(&free_area_list.lock, "buddy");
-    void* base = (void*)ROUNDUP((uint)end, MAXSIZE);  //the address of the first page
-    void* bounds = (void*) ROUNDDOWN((uint)PHYSTOP, MAXSIZE); //the byte after the last byte of the last page
+    heapend = (uint)KADDR(physend);
+    heapstart = ROUNDUP((uint)end, MAXSIZE);
+    //make room for the bitmaps
+    while((uint)end + bitmapsize(heapstart, heapend) > heapstart)
+        heapstart += MAXPGSIZE;
+    if(heapstart >= heapend)
+        panic("buddy_init: no memory");
+    void* base = (void*)heapstart;  //the address of the first page
+    void* bounds = (void*)heapend; //the byte after the last byte of the last page
     void* offset = end;
     for(int i = MAXSIZE; i >= 0; i--) {
         //initialize each of the free areas
@@ -171,17 +198,19 @@ buddy_init(void) {
         }
 
     }
-    // the free_list points to the base because every page is available
-    free_area_list.free_areas[MAXSIZE].free_list = base;
-    offset = base;
-    for(; (uint)offset + MAXPGSIZE <= (uint)PHYSTOP; offset = (void*)((uint)offset + MAXPGSIZE)) {
-        if((uint)offset + 2* MAXPGSIZE > (uint)PHYSTOP) {
-            // if this is the last page then next = NULL
-            ((node*)offset)->next = NULL; 
-        } else {
-            // if there are more pages, then set next to the next block
-            ((node*)offset)->next = offset + MAXPGSIZE;
+    // whole blocks of usable memory go on the free list, highest
+    // last so the list starts at the base.  A block with a hole in
+    // it is taken as allocated, split, and its usable pages freed.
+    for(offset = bounds - MAXPGSIZE; offset >= base; offset -= MAXPGSIZE) {
+        if(memusable(PADDR(offset), MAXPGSIZE)) {
+            list_push(&free_area_list.free_areas[MAXSIZE].free_list, offset);
+            continue;
         }
+        set_bit(free_area_list.free_areas[MAXSIZE].allocated, get_index(offset, MAXSIZE));
+        buddy_split(offset);
+        for(char* p = offset; p < (char*)offset + MAXPGSIZE; p += PGSIZE)
+            if(memusable(PADDR(p), PGSIZE))
+                buddy_free(p);
     }
 }
 
@@ -201,14 +230,14 @@ min_order(unsigned int n) {
 int
 get_index(void* p, int o) {
     // find index of the page at address p with order 0
-    int n = (uint)p - ROUNDUP((uint)end, MAXSIZE);
+    int n = (uint)p - heapstart;
     return n / BLOCKSIZE(o);
 }
 
 void*
 get_address(int i, int o) {
     // get the address associated with index i of size o
-    return (void*)(ROUNDUP((uint)end, MAXSIZE) + i * BLOCKSIZE(o));
+    return (void*)(heapstart + i * BLOCKSIZE(o));
 }
 
 void*
@@ -256,7 +285,8 @@ uint size_of(void* p) {
         if(bit_is_set(free_area_list.free_areas[i+1].split, get_index(p, i+1)))
             return i;
     }
-    return 0;
+    // nothing above p is split, so p is a whole 4MB block
+    return MAXSIZE;
 }
 void
 buddy_free(void* p) {
@@ -273,6 +303,9 @@ buddy_free(void* p) {
         int index = get_index(p, i);
         //set it to unallocated
         clear_bit(free_area_list.free_areas[i].allocated, index);
+        //4MB blocks have no buddy to coalesce with
+        if(i == MAXSIZE)
+            break;
         //get its buddy.
         //case 1: p is the second block in its pair, then we need index -1
         //case 2: p is the first block in its pair, then we need index + 1
@@ -304,6 +337,23 @@ buddy_free(void* p) {
     release(&free_area_list.lock);
 }
 
+// Turn the allocated 4MB block p into separately allocated 4K
+// blocks, as if each had come from its own buddy_alloc(PGSIZE), so
+// the pages of a huge page can be freed one at a time.
+void
+buddy_split(void* p) {
+    acquire(&free_area_list.lock);
+    for(int i = MAXSIZE; i > 0; i--) {
+        int first = get_index(p, i);
+        for(int j = first; j < first + (1 << (MAXSIZE - i)); j++) {
+            set_bit(free_area_list.free_areas[i].split, j);
+            set_bit(free_area_list.free_areas[i-1].allocated, 2*j);
+            set_bit(free_area_list.free_areas[i-1].allocated, 2*j + 1);
+        }
+    }
+    release(&free_area_list.lock);
+}
+
 
 // Initialize free list of physical pages, of size 4MB (MAXPGSIZE)
 void
@@ -328,7 +378,7 @@ kinit(void)
 void
 kfree(char *v)
 {
-  if((uint)v % PGSIZE || v < end || (uint)v >= PHYSTOP) 
+  if((uint)v % PGSIZE || (uint)v < heapstart || (uint)v >= heapend)
     panic("kfree");
 
 
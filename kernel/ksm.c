@@ -0,0 +1,323 @@
+// Kernel same-page merging.
+//
+// The ksmd kernel process looks through the 4K user pages of every
+// address space and merges pages with identical contents into one
+// frame, shared copy-on-write: the PTEs mapping it have PTE_SHR set
+// and PTE_W clear, and a write through one of them gets a private
+// copy (see ksmfault() in vm.c).  ksmctl() sets how many pages ksmd
+// looks at and how often; until then it does nothing.
+//
+// Every page looked at is hashed.  A merged frame with the same hash
+// and contents takes it in.  Otherwise it is compared with the last
+// page seen with the same hash, its candidate, and if the two match
+// they become a new merged frame.
+//
+// Page tables are only changed while their address space has a
+// single thread and could be swapped out (see mergelock() in
+// proc.c), so no CPU has a TLB entry for a page being replaced, and
+// no thread can keep reading a merged frame through a stale TLB
+// entry while another writes to its private copy.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "memstat.h"
+
+#define NKSMPAGE 1024  // merged frames
+#define NKSMCAND 1024  // candidates, one per hash bucket
+
+#define MERGEABLE(e)  (((e) & (PTE_P|PTE_W|PTE_U|PTE_SHR)) == (PTE_P|PTE_W|PTE_U))
+#define SHAREDPTE(f)  (PADDR(f) | PTE_SHR | PTE_U | PTE_P)
+
+struct ksmpage {
+  char *frame;                 // 0 if the entry is free
+  uint hash;
+  int ref;                     // PTEs mapping frame
+};
+
+struct ksmcand {
+  pde_t *pgdir;                // 0 if the bucket is empty
+  uint va;
+  char *frame;                 // frame va mapped when hashed
+  uint hash;
+};
+
+// lock is taken with ptable.lock held, by mergelock() callers and
+// by freevm() in wait(), so ksmd sleeps for a scan rate under
+// ratelock instead.
+static struct {
+  struct spinlock lock;
+  struct ksmpage page[NKSMPAGE];
+  struct ksmcand cand[NKSMCAND];
+  uint scans;                  // full passes over all address spaces
+
+  struct spinlock ratelock;
+  int npages;                  // pages to look at every
+  int nticks;                  // nticks clock ticks
+} ksm;
+
+// Scan position, used only by ksmd: a process table slot and a
+// user address in its address space.
+static int slot;
+static uint scanva;
+
+void
+ksminit(void)
+{
+  initlock(&ksm.lock, "ksm");
+  initlock(&ksm.ratelock, "ksmrate");
+}
+
+// Look at npages pages every nticks ticks; 0 pages stops ksmd.
+int
+ksmctl(int npages, int nticks)
+{
+  if(npages < 0 || nticks < 1)
+    return -1;
+  acquire(&ksm.ratelock);
+  ksm.npages = npages;
+  ksm.nticks = nticks;
+  wakeup(&ksm.npages);
+  release(&ksm.ratelock);
+  return 0;
+}
+
+void
+ksmstat(struct memstat *m)
+{
+  struct ksmpage *k;
+
+  m->ksmshared = m->ksmsaved = 0;
+  acquire(&ksm.lock);
+  for(k = ksm.page; k < &ksm.page[NKSMPAGE]; k++){
+    if(k->frame){
+      m->ksmshared++;
+      m->ksmsaved += k->ref - 1;
+    }
+  }
+  m->ksmscans = ksm.scans;
+  release(&ksm.lock);
+}
+
+// Caller holds ksm.lock.
+static struct ksmpage*
+ksmfind(char *frame)
+{
+  struct ksmpage *k;
+
+  for(k = ksm.page; k < &ksm.page[NKSMPAGE]; k++)
+    if(k->frame == frame)
+      return k;
+  panic("ksmfind");
+}
+
+// Another PTE maps merged frame.
+void
+ksmget(char *frame)
+{
+  acquire(&ksm.lock);
+  ksmfind(frame)->ref++;
+  release(&ksm.lock);
+}
+
+// A PTE mapping merged frame is gone.  Frees the frame with the
+// last one.
+void
+ksmput(char *frame)
+{
+  struct ksmpage *k;
+  int ref;
+
+  acquire(&ksm.lock);
+  k = ksmfind(frame);
+  if((ref = --k->ref) == 0)
+    k->frame = 0;
+  release(&ksm.lock);
+  if(ref == 0)
+    kfree(frame);
+}
+
+// If the caller's PTE is the only one left mapping merged frame,
+// stop tracking the frame and return 1: the caller may make it its
+// own private page.  Otherwise return 0.
+int
+ksmlast(char *frame)
+{
+  struct ksmpage *k;
+  int r;
+
+  acquire(&ksm.lock);
+  k = ksmfind(frame);
+  r = k->ref == 1;
+  if(r){
+    k->ref = 0;
+    k->frame = 0;
+  }
+  release(&ksm.lock);
+  return r;
+}
+
+static uint
+ksmhash(char *frame)
+{
+  uint *w, h;
+
+  // FNV-1a, a word at a time.
+  h = 2166136261U;
+  for(w = (uint*)frame; w < (uint*)(frame + PGSIZE); w++)
+    h = (h ^ *w) * 16777619;
+  return h;
+}
+
+// Merge the page at va in pgdir, whose PTE was e and whose contents
+// hashed to h, with an identical page if one is known, or make it
+// the candidate for its hash.  Returns -1 if pgdir cannot be
+// changed now.
+static int
+ksmmerge(pde_t *pgdir, uint va, pte_t e, uint h)
+{
+  struct ksmpage *k, *free;
+  struct ksmcand *c;
+  pte_t *pte, *cpte;
+  char *frame, *old;
+
+  if(!mergelock(pgdir))
+    return -1;
+  frame = (char*)KADDR(PTE_ADDR(e));
+  old = 0;
+  // The contents may have changed since they were hashed, but
+  // pages are only merged after comparing them.
+  if((pte = uvmpte(pgdir, va)) == 0 || !MERGEABLE(*pte) ||
+     PTE_ADDR(*pte) != PADDR(frame))
+    goto out;
+
+  acquire(&ksm.lock);
+  free = 0;
+  for(k = ksm.page; k < &ksm.page[NKSMPAGE]; k++){
+    if(k->frame == 0){
+      if(free == 0)
+        free = k;
+    } else if(k->hash == h && memcmp(k->frame, frame, PGSIZE) == 0)
+      break;
+  }
+  if(k < &ksm.page[NKSMPAGE]){
+    if(setpte(pgdir, va, pte, *pte, SHAREDPTE(k->frame)) > 0){
+      k->ref++;
+      old = frame;
+    }
+    goto unlock;
+  }
+
+  c = &ksm.cand[h % NKSMCAND];
+  if(free && c->pgdir && c->hash == h && c->frame != frame &&
+     mergealso(c->pgdir) && (cpte = uvmpte(c->pgdir, c->va)) != 0 &&
+     MERGEABLE(*cpte) && PTE_ADDR(*cpte) == PADDR(c->frame) &&
+     memcmp(c->frame, frame, PGSIZE) == 0){
+    // The reverse map may be full for our new mapping of c->frame,
+    // but c's mapping only changes its flags.
+    if(setpte(pgdir, va, pte, *pte, SHAREDPTE(c->frame)) > 0){
+      setpte(c->pgdir, c->va, cpte, *cpte, SHAREDPTE(c->frame));
+      free->frame = c->frame;
+      free->hash = h;
+      free->ref = 2;
+      old = frame;
+    }
+    c->pgdir = 0;
+  } else {
+    c->pgdir = pgdir;
+    c->va = va;
+    c->frame = frame;
+    c->hash = h;
+  }
+unlock:
+  release(&ksm.lock);
+out:
+  swapunlock();
+  if(old)
+    kfree(old);
+  return 0;
+}
+
+// Look at up to n pages of pgdir from the scan position.  Returns
+// the number looked at, leaving scanva at USERTOP when done with
+// pgdir.
+static int
+ksmscanpgdir(pde_t *pgdir, int n)
+{
+  pte_t *pte, e;
+  int i;
+
+  for(i = 0; i < n && scanva < USERTOP; scanva += PGSIZE){
+    // pgdir is held by the caller, so reading the PTE without a
+    // lock is safe; ksmmerge() checks it again under the lock.
+    if((pte = uvmpte(pgdir, scanva)) == 0){
+      scanva = ROUNDDOWN(scanva, MAXSIZE) + MAXPGSIZE - PGSIZE;
+      continue;
+    }
+    e = *pte;
+    if(!MERGEABLE(e))
+      continue;
+    i++;
+    if(ksmmerge(pgdir, scanva, e, ksmhash((char*)KADDR(PTE_ADDR(e)))) < 0){
+      // Busy: come back on the next pass.
+      scanva = USERTOP;
+      break;
+    }
+  }
+  return i;
+}
+
+// Look at up to n pages, continuing from the scan position, without
+// going round the process table more than once.
+static void
+ksmscan(int n)
+{
+  pde_t *pgdir;
+  int i;
+
+  for(i = 0; n > 0 && i < NPROC; ){
+    if((pgdir = swapvictim(slot)) != 0){
+      n -= ksmscanpgdir(pgdir, n);
+      freevm(pgdir);
+    } else
+      scanva = USERTOP;
+    if(scanva >= USERTOP){
+      scanva = 0;
+      i++;
+      if(++slot == NPROC){
+        slot = 0;
+        acquire(&ksm.lock);
+        ksm.scans++;
+        release(&ksm.lock);
+      }
+    }
+  }
+}
+
+// The ksmd kernel process.
+void
+ksmd(void)
+{
+  int n, t;
+  uint ticks0;
+
+  for(;;){
+    acquire(&ksm.ratelock);
+    while(ksm.npages == 0)
+      sleep(&ksm.npages, &ksm.ratelock);
+    n = ksm.npages;
+    t = ksm.nticks;
+    release(&ksm.ratelock);
+
+    ksmscan(n);
+
+    acquire(&tickslock);
+    ticks0 = ticks;
+    while(ticks - ticks0 < t)
+      sleeptimeout(&ticks0, &tickslock, t - (ticks - ticks0));
+    release(&tickslock);
+  }
+}
@@ -0,0 +1,187 @@
+// Kernel timers.
+//
+// ktimeradd(t, n, fn, arg) has fn(arg) called from the timer
+// interrupt on CPU 0 once n ticks have passed; ktimerdel(t) cancels
+// it.  A struct ktimer belongs to its caller, typically on the kernel
+// stack, and must stay put until it has fired or been cancelled.
+//
+// Pending timers sit in a hierarchical timing wheel: the first level
+// has a slot for each of the next 256 ticks, and each of the three
+// further levels has 64 slots, each covering 64 times as many ticks
+// as a slot of the level below.  A timer is put in the lowest level
+// whose range reaches its expiry.  Each tick ktimertick() fires the
+// timers in one first-level slot, and every 256 ticks it moves the
+// timers in the next slot of the second level down into the first
+// (and so on up), so a timer is touched only a few times however
+// far off it is.  Timers further off than the wheel reaches (2^26
+// ticks) fire at its end.
+//
+// The callbacks run with ktimerlock held, so that once ktimerdel()
+// returns the callback is not running either.  They must be short,
+// and may only take locks that are never held while calling
+// ktimeradd() or ktimerdel(); ptable.lock (through wakeup()) is one.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "ktimer.h"
+
+#define WHEEL0BITS  8
+#define WHEELNBITS  6
+#define NWHEEL0     (1 << WHEEL0BITS)
+#define NWHEELN     (1 << WHEELNBITS)
+#define NLEVEL      3                  // levels above the first
+#define MAXDELAY    ((1 << (WHEEL0BITS + NLEVEL*WHEELNBITS)) - 1)
+
+// Bits of an expiry that pick its slot at level l (0 the first).
+#define SHIFT(l)    ((l) == 0 ? 0 : WHEEL0BITS + ((l)-1)*WHEELNBITS)
+
+static struct spinlock ktimerlock;
+static struct ktimer *wheel0[NWHEEL0];
+static struct ktimer *wheeln[NLEVEL][NWHEELN];
+static uint wheeltime;                 // next tick the wheel fires
+
+void
+ktimerinit(void)
+{
+  initlock(&ktimerlock, "ktimer");
+}
+
+// Put t in the slot its expiry falls into.  Caller holds ktimerlock.
+static void
+wheelput(struct ktimer *t)
+{
+  struct ktimer **slot;
+  uint d;
+  int l;
+
+  d = t->expires - wheeltime;
+  if((int)d < 0){
+    // Already due: fire with the next tick.
+    slot = &wheel0[wheeltime % NWHEEL0];
+  } else if(d < NWHEEL0){
+    slot = &wheel0[t->expires % NWHEEL0];
+  } else {
+    if(d > MAXDELAY){
+      t->expires = wheeltime + MAXDELAY;
+      d = MAXDELAY;
+    }
+    for(l = 1; d >= 1 << SHIFT(l+1) && l < NLEVEL; l++)
+      ;
+    slot = &wheeln[l-1][(t->expires >> SHIFT(l)) % NWHEELN];
+  }
+  t->next = *slot;
+  if(t->next)
+    t->next->pprev = &t->next;
+  t->pprev = slot;
+  *slot = t;
+}
+
+// Take t out of its slot.  Caller holds ktimerlock.
+static void
+wheeldel(struct ktimer *t)
+{
+  *t->pprev = t->next;
+  if(t->next)
+    t->next->pprev = t->pprev;
+  t->next = 0;
+  t->pprev = 0;
+}
+
+// Move the timers in slot i of level l (1 and up) down to the
+// levels below.
+static void
+cascade(int l, int i)
+{
+  struct ktimer *t, *next;
+
+  t = wheeln[l-1][i];
+  wheeln[l-1][i] = 0;
+  for(; t; t = next){
+    next = t->next;
+    wheelput(t);
+  }
+}
+
+// Call fn(arg) once n ticks from now have passed.  t must not be
+// pending already.
+void
+ktimeradd(struct ktimer *t, uint n, void (*fn)(void*), void *arg)
+{
+  acquire(&ktimerlock);
+  t->fn = fn;
+  t->arg = arg;
+  t->expires = ticks + n;
+  wheelput(t);
+  release(&ktimerlock);
+}
+
+// Cancel t.  Returns 1 if it was still pending, 0 if it has fired.
+int
+ktimerdel(struct ktimer *t)
+{
+  int pending;
+
+  acquire(&ktimerlock);
+  pending = t->pprev != 0;
+  if(pending)
+    wheeldel(t);
+  release(&ktimerlock);
+  return pending;
+}
+
+// Find the tick by which ktimertick() next has work: a timer's
+// expiry, or bringing timers down from a level above.  Returns 0 if
+// no timer is pending.  For tickless CPUs (clock.c).
+int
+ktimernext(uint *when)
+{
+  uint cascade;
+  int i, l, found;
+
+  found = 0;
+  acquire(&ktimerlock);
+  for(i = 0; i < NWHEEL0; i++){
+    if(wheel0[(wheeltime + i) % NWHEEL0]){
+      *when = wheeltime + i;
+      found = 1;
+      break;
+    }
+  }
+  cascade = (wheeltime + NWHEEL0 - 1) & ~(NWHEEL0 - 1);
+  for(l = 0; l < NLEVEL; l++){
+    for(i = 0; i < NWHEELN; i++){
+      if(wheeln[l][i] && (!found || (int)(cascade - *when) < 0)){
+        *when = cascade;
+        found = 1;
+      }
+    }
+  }
+  release(&ktimerlock);
+  return found;
+}
+
+// Fire the timers that are due.  Called by the timer interrupt on
+// CPU 0 after it has advanced ticks.
+void
+ktimertick(void)
+{
+  struct ktimer *t;
+  int i, l;
+
+  acquire(&ktimerlock);
+  while((int)(ticks - wheeltime) >= 0){
+    i = wheeltime % NWHEEL0;
+    // At the start of each turn of a level, bring down the next
+    // slot of the level above.
+    for(l = 1; l <= NLEVEL && (wheeltime & ((1 << SHIFT(l)) - 1)) == 0; l++)
+      cascade(l, (wheeltime >> SHIFT(l)) % NWHEELN);
+    wheeltime++;
+    while((t = wheel0[i]) != 0){
+      wheeldel(t);
+      t->fn(t->arg);
+    }
+  }
+  release(&ktimerlock);
+}
@@ -0,0 +1,13 @@
+#ifndef _KTIMER_H_
+#define _KTIMER_H_
+
+// A kernel timer (see ktimer.c).
+struct ktimer {
+  uint expires;                // tick at which fn runs
+  void (*fn)(void*);
+  void *arg;
+  struct ktimer *next;         // in its wheel slot
+  struct ktimer **pprev;       // what points to it, or 0 if not pending
+};
+
+#endif // _KTIMER_H_
@@ -4,6 +4,7 @@
 #include "types.h"
 #include "defs.h"
 #include "traps.h"
+#include "param.h"
 #include "mmu.h"
 #include "x86.h"
 
@@ -39,6 +40,7 @@
 #define TDCR    (0x03E0/4)   // Timer Divide Configuration
 
 volatile uint *lapic;  // Initialized in mp.c
+uint lapicfreq;        // Timer counts per second; see timercalibrate()
 
 static void
 lapicw(int index, int value)
@@ -58,12 +60,14 @@ lapicinit(int c)
   lapicw(SVR, ENABLE | (T_IRQ0 + IRQ_SPURIOUS));
 
   // The timer repeatedly counts down at bus frequency
-  // from lapic[TICR] and then issues an interrupt.  
-  // If xv6 cared more about precise timekeeping,
-  // TICR would be calibrated using an external time source.
+  // from lapic[TICR] and then issues an interrupt, HZ times a
+  // second once the first CPU has calibrated it.  clockstart()
+  // switches it to one-shot mode for tickless operation.
   lapicw(TDCR, X1);
+  if(lapicfreq == 0)
+    timercalibrate();
   lapicw(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
-  lapicw(TICR, 10000000); 
+  lapicw(TICR, lapicfreq/HZ > 0 ? lapicfreq/HZ : 10000000);
 
   // Disable logical interrupt lines.
   lapicw(LINT0, MASKED);
@@ -114,6 +118,39 @@ cpunum(void)
   return 0;
 }
 
+// Send interrupt vector to the CPU whose local APIC ID is apicid.
+// Interrupts must be off.
+void
+lapicipi(int apicid, int vector)
+{
+  if(!lapic)
+    return;
+  lapicw(ICRHI, apicid<<24);
+  lapicw(ICRLO, FIXED | ASSERT | vector);
+  while(lapic[ICRLO] & DELIVS)
+    ;
+}
+
+// Switch the timer to one-shot mode and have it interrupt after n
+// counts.
+void
+lapiconeshot(uint n)
+{
+  if(!lapic)
+    return;
+  lapicw(TIMER, T_IRQ0 + IRQ_TIMER);
+  lapicw(TICR, n);
+}
+
+// Counts left before the timer interrupts; 0 once it has.
+uint
+lapiccount(void)
+{
+  if(!lapic)
+    return 0;
+  return lapic[TCCR];
+}
+
 // Acknowledge interrupt.
 void
 lapiceoi(void)
@@ -144,7 +181,7 @@ lapicstartap(uchar apicid, uint addr)
   // the AP startup code prior to the [universal startup algorithm]."
   outb(IO_RTC, 0xF);  // offset 0xF is shutdown code
   outb(IO_RTC+1, 0x0A);
-  wrv = (ushort*)(0x40<<4 | 0x67);  // Warm reset vector
+  wrv = (ushort*)KADDR(0x40<<4 | 0x67);  // Warm reset vector
   wrv[0] = 0;
   wrv[1] = addr >> 4;
 
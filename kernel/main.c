@@ -20,6 +20,7 @@ main(void)
   mpinit();        // collect info about this machine
   lapicinit(mpbcpu());
   seginit();       // set up segments
+  memmapinit();    // find the usable physical memory
   kinit();         // initialize memory allocator
   jmpkstack();       // call mainc() on a properly-allocated stack 
 }
@@ -43,17 +44,30 @@ void
 mainc(void)
 {
   cprintf("\ncpu%d: starting xv6\n\n", cpu->id);
+  cprintf("memory: %d MB usable, %d MB mapped\n", memsize() >> 20, physend >> 20);
+  fpuinit();       // SSE, used by memmove() and memset()
   picinit();       // interrupt controller
   ioapicinit();    // another interrupt controller
   consoleinit();   // I/O devices & their interrupts
   uartinit();      // serial port
   kvmalloc();      // initialize the kernel page table
+  vdsoinit();      // user-readable kernel data page
   pinit();         // process table
   tvinit();        // trap vectors
   binit();         // buffer cache
   fileinit();      // file table
+  ktimerinit();    // kernel timers
+  clockinit();     // timer interrupts: periodic or tickless
+  futexinit();     // futex wait queues
+  userfaultinit(); // userfault registrations
+  ksminit();       // page merging
+  rmapinit();      // reverse map
   iinit();         // inode cache
   ideinit();       // disk
+  swapinit();      // swap area
+#ifdef MEMBENCH
+  membench();      // time memmove() and memset() variants
+#endif
   if(!ismp)
     timerinit();   // uniprocessor timer
   bootothers();    // start other processors
@@ -62,6 +76,7 @@ mainc(void)
   cinit();
   sti();           // enable inturrupts
   userinit();      // first user process
+  kproc("ksmd", ksmd); // page merging scanner
   scheduler();     // start running processes
 }
 
@@ -69,12 +84,15 @@ mainc(void)
 static void
 cinit(void) {
   if(cpunum() != mpbcpu()){
+    fpuinit();
     seginit();
     lapicinit(cpunum());
   }
   vmenable();        // turn on paging
   cprintf("cpu%d: starting\n", cpu->id);
   idtinit();       // load idt register
+  sysenterinit();  // fast system calls
+  clockstart();    // this CPU's tickless timer
   xchg(&cpu->booted, 1); // tell bootothers() we're up
 }
 
@@ -93,6 +111,9 @@ static void
 bootothers(void)
 {
   extern uchar _binary_bootother_start[], _binary_bootother_size[];
+#if KERNBASE
+  extern pde_t entrypgdir[];
+#endif
   uchar *code;
   struct cpu *c;
   char *stack;
@@ -100,7 +121,7 @@ bootothers(void)
   // Write bootstrap code to unused memory at 0x7000.
   // The linker has placed the image of bootother.S in
   // _binary_bootother_start.
-  code = (uchar*)0x7000;
+  code = KADDR(0x7000);
   memmove(code, _binary_bootother_start, (uint)_binary_bootother_size);
 
   for(c = cpus; c < cpus+ncpu; c++){
@@ -113,8 +134,13 @@ bootothers(void)
     stack = kalloc();
     *(void**)(code-4) = stack + KSTACKSIZE;
     *(void**)(code-8) = mpmain;
+#if KERNBASE
+    // And the boot page table, to turn on paging with before
+    // jumping to mpmain (see multiboot.S).
+    *(uint*)(code-12) = PADDR(entrypgdir);
+#endif
 
-    lapicstartap(c->id, (uint)code);
+    lapicstartap(c->id, PADDR(code));
 
     // Wait for cpu to finish mpmain()
     while(c->booted == 0)
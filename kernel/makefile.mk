@@ -2,22 +2,30 @@
 # Kernel objects
 KERNEL_OBJECTS := \
 	bio.o\
+	clock.o\
 	console.o\
 	exec.o\
 	file.o\
+	fpu.o\
 	fs.o\
+	futex.o\
 	ide.o\
 	ioapic.o\
 	kalloc.o\
 	kbd.o\
+	ksm.o\
+	ktimer.o\
 	lapic.o\
 	main.o\
+	memmap.o\
 	mp.o\
 	picirq.o\
 	pipe.o\
 	proc.o\
+	rmap.o\
 	spinlock.o\
 	string.o\
+	swap.o\
 	swtch.o\
 	syscall.o\
 	sysfile.o\
@@ -26,6 +34,8 @@ KERNEL_OBJECTS := \
 	trapasm.o\
 	trap.o\
 	uart.o\
+	userfault.o\
+	vdso.o\
 	vectors.o\
 	vm.o\
 
@@ -77,6 +87,37 @@ KERNEL_CFLAGS += -fno-strict-aliasing
 KERNEL_CFLAGS += -fno-stack-protector
 # generate code for 32-bit environment
 KERNEL_CFLAGS += -m32
+# make MEMBENCH=1 times the memmove() and memset() variants at boot
+ifdef MEMBENCH
+KERNEL_CFLAGS += -DMEMBENCH
+endif
+# make KERNBASE=0x40000000 (or 0x80000000) links the kernel at
+# KERNBASE+1M and gives user programs all the addresses below KERNBASE
+# (see include/param.h); make clean first when switching
+ifdef KERNBASE
+KERNEL_CFLAGS += -DKERNBASE=$(KERNBASE)
+KERNEL_LINK := $(shell printf '0x%x' $$(($(KERNBASE) + 0x100000)))
+KERNEL_ENTRY := _start
+else
+KERNEL_LINK := 0x1080000
+KERNEL_ENTRY := main
+endif
+# make PAE=1 builds a kernel that pages in PAE mode, with 2M huge pages
+# (make clean first when switching)
+ifdef PAE
+KERNEL_CFLAGS += -DPAE
+endif
+# make SCHED=fair makes the fair scheduling class the default; a
+# multiboot command line with sched=fair or sched=mlfq overrides it
+ifeq ($(SCHED),fair)
+KERNEL_CFLAGS += -DSCHED_FAIR_DEFAULT
+endif
+# make TICKLESS=1 runs the local APIC timers one-shot, so idle CPUs do
+# not tick; tickless=on or tickless=off on a multiboot command line
+# overrides it
+ifdef TICKLESS
+KERNEL_CFLAGS += -DTICKLESS
+endif
 
 KERNEL_ASFLAGS += $(KERNEL_CFLAGS)
 
@@ -87,16 +128,18 @@ KERNEL_LDFLAGS += -nostdlib
 # use simple contiguous section layout and do not use dynamic linking
 KERNEL_LDFLAGS += --omagic
 
-# bootable disk image
+# bootable disk image, followed by the swap area, which ends at
+# sector SWAPSTART + NSWAPPG*8 (see include/param.h)
 xv6.img: kernel/bootblock kernel/kernel
 	dd if=/dev/zero of=xv6.img count=10000
 	dd if=kernel/bootblock of=xv6.img conv=notrunc
 	dd if=kernel/kernel of=xv6.img seek=1 conv=notrunc
+	dd if=/dev/zero of=xv6.img seek=75536 count=0
 
 kernel/kernel:	\
 		$(KERNEL_OBJECTS) kernel/multiboot.o kernel/data.o bootother initcode
 	$(LD) $(LDFLAGS) $(KERNEL_LDFLAGS) \
-		--section-start=.text=0x1080000 --entry=main --output=kernel/kernel \
+		--section-start=.text=$(KERNEL_LINK) --entry=$(KERNEL_ENTRY) --output=kernel/kernel \
 		kernel/multiboot.o kernel/data.o $(KERNEL_OBJECTS) \
 		-b binary initcode bootother
 
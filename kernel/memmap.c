@@ -0,0 +1,164 @@
+// Physical memory map.
+//
+// memmapinit() finds the usable RAM from the boot loader's map:
+// the multiboot memory map if a multiboot loader (multiboot.S)
+// started the kernel, or else the BIOS E820 map that bootasm.S
+// collected.  kalloc.c hands out only memory in these ranges, and
+// vm.c maps physical memory up to physend.  Memory above PHYSTOP
+// is left alone.  The maps are read through KADDR(), since paging
+// may already be on (see multiboot.S).  The multiboot command line
+// is kept for bootcmdline().
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+
+#define E820MAP    0x8000      // where bootasm.S leaves the E820 map
+#define E820RAM    1           // type of usable memory
+#define MBMAGIC    0x2BADB002  // in %eax from a multiboot loader
+#define MBMEM      (1<<0)      // multiboot flags: mem_lower, mem_upper
+#define MBCMDLINE  (1<<2)      // multiboot flags: cmdline
+#define MBMMAP     (1<<6)      // multiboot flags: mmap_*
+#define NMEMRANGE  16
+
+struct e820 {
+  uint base, basehi;
+  uint len, lenhi;
+  uint type;
+} __attribute__((packed));
+
+// Multiboot information, as far as it is used here.
+struct mbinfo {
+  uint flags;
+  uint memlower, memupper;     // KB below 1M and above 1M
+  uint bootdevice;
+  uint cmdline;                // physical address of a C string
+  uint unused[6];
+  uint mmaplen, mmapaddr;
+};
+
+// Multiboot memory map entry; size does not count itself.
+struct mbmmap {
+  uint size;
+  struct e820 e;
+} __attribute__((packed));
+
+uint mbmagic, mbinfo;          // set by multiboot.S
+
+static struct memrange {
+  uint start, end;
+} mem[NMEMRANGE];
+static int nmem;
+
+uint physend;                  // end of memory that vm.c maps
+
+// Copied before kinit() can hand out the memory it is in.
+static char cmdline[128];
+
+// Note the usable memory from base to base+len, clipped to whole
+// pages below PHYSTOP, keeping mem[] sorted and merged.
+static void
+memadd(uint base, uint basehi, uint len, uint lenhi)
+{
+  uint start, end;
+  int i, j;
+
+  if(basehi != 0 || base >= PHYSTOP)
+    return;
+  if(lenhi != 0 || len > PHYSTOP - base)
+    len = PHYSTOP - base;
+  start = PGROUNDUP(base);
+  end = (uint)PGROUNDDOWN(base + len);
+  if(start >= end)
+    return;
+  for(i = 0; i < nmem && mem[i].end < start; i++)
+    ;
+  if(i < nmem && mem[i].start <= end){
+    // Overlaps or touches mem[i], and maybe those after it.
+    if(start < mem[i].start)
+      mem[i].start = start;
+    if(end > mem[i].end)
+      mem[i].end = end;
+    while(i+1 < nmem && mem[i+1].start <= mem[i].end){
+      if(mem[i+1].end > mem[i].end)
+        mem[i].end = mem[i+1].end;
+      for(j = i+1; j+1 < nmem; j++)
+        mem[j] = mem[j+1];
+      nmem--;
+    }
+    return;
+  }
+  if(nmem == NMEMRANGE)
+    return;
+  for(j = nmem; j > i; j--)
+    mem[j] = mem[j-1];
+  mem[i].start = start;
+  mem[i].end = end;
+  nmem++;
+}
+
+void
+memmapinit(void)
+{
+  struct mbinfo *mb;
+  struct mbmmap *m;
+  struct e820 *e, *ee;
+
+  if(mbmagic == MBMAGIC){
+    mb = KADDR(mbinfo);
+    if((mb->flags & MBCMDLINE) && mb->cmdline != 0 && mb->cmdline < PHYSTOP)
+      safestrcpy(cmdline, KADDR(mb->cmdline), sizeof(cmdline));
+    if(mb->flags & MBMMAP){
+      for(m = KADDR(mb->mmapaddr);
+          (uint)m < (uint)KADDR(mb->mmapaddr + mb->mmaplen);
+          m = (struct mbmmap*)((uint)m + m->size + 4))
+        if(m->e.type == E820RAM)
+          memadd(m->e.base, m->e.basehi, m->e.len, m->e.lenhi);
+    } else if(mb->flags & MBMEM)
+      memadd(0x100000, 0, mb->memupper * 1024, 0);
+  } else {
+    e = KADDR(E820MAP + 2);
+    ee = KADDR(*(ushort*)KADDR(E820MAP));
+    for(; e < ee; e++)
+      if(e->type == E820RAM)
+        memadd(e->base, e->basehi, e->len, e->lenhi);
+  }
+  if(nmem == 0)
+    panic("memmapinit: no memory map");
+  physend = ROUNDUP(mem[nmem-1].end, MAXSIZE);
+  if(physend > PHYSTOP || physend == 0)
+    physend = PHYSTOP;
+}
+
+// Is all of [pa, pa+len) usable memory?
+int
+memusable(uint pa, uint len)
+{
+  int i;
+
+  for(i = 0; i < nmem; i++)
+    if(mem[i].start <= pa && pa + len <= mem[i].end)
+      return 1;
+  return 0;
+}
+
+// Bytes of usable memory.
+uint
+memsize(void)
+{
+  uint n;
+  int i;
+
+  n = 0;
+  for(i = 0; i < nmem; i++)
+    n += mem[i].end - mem[i].start;
+  return n;
+}
+
+// The kernel command line from a multiboot loader, or "".
+char*
+bootcmdline(void)
+{
+  return cmdline;
+}
@@ -28,8 +28,12 @@
 
 // User defined macros for huge pages
 
-#define MAXORDER    11          //number of sizes
+#ifdef PAE
+#define MAXSIZE     9            //maximum size: a 2M page in PAE mode
+#else
 #define MAXSIZE     10           //maximum size
+#endif
+#define MAXORDER    (MAXSIZE+1)  //number of sizes
 #define ROUNDUP(n, order)   (((n + (1 << (12+ order)) -1) >> (12+order))  << (12+order))
 #define ROUNDDOWN(n, order)   (((n) >> (12+order))  << (12+order))
 #define BLOCKSIZE(order)    ((1L << (order)) * (PGSIZE))
@@ -50,6 +54,9 @@
 #define CR0_CD		0x40000000	// Cache Disable
 #define CR0_PG		0x80000000	// Paging
 #define CR4_PSE     0x00000010  // Page size extension
+#define CR4_PAE     0x00000020  // Physical address extension
+#define CR4_OSFXSR  0x00000200  // fxsave/fxrstor and SSE enabled
+#define CR4_OSXMMEXCPT 0x00000400  // SSE exceptions unmasked by OS
 // Segment Descriptor
 struct segdesc {
   uint lim_15_0 : 16;  // Low bits of segment limit
@@ -109,30 +116,57 @@ struct segdesc {
 // +----------------+----------------+---------------------+
 //  \--- PDX(la) --/ \--- PTX(la) --/
 
+//
+// In PAE mode (make PAE=1) entries are 64 bits and a page table or
+// page directory holds 512 of them, so PTX is 9 bits and a PDE maps
+// 2M.  CR3 points to a page-directory-pointer table of four entries,
+// one per page directory; vm.c keeps the page directories of an
+// address space one after another and indexes them together with an
+// 11-bit PDX.
+
+#ifdef PAE
+// page directory index, across all four page directories
+#define PDX(la)		(((uint)(la) >> PDXSHIFT) & 0x7FF)
+
+// page table index
+#define PTX(la)		(((uint)(la) >> PTXSHIFT) & 0x1FF)
+#else
 // page directory index
 #define PDX(la)		(((uint)(la) >> PDXSHIFT) & 0x3FF)
 
 // page table index
 #define PTX(la)		(((uint)(la) >> PTXSHIFT) & 0x3FF)
+#endif
 
 // construct linear address from indexes and offset
 #define PGADDR(d, t, o)	((uint)((d) << PDXSHIFT | (t) << PTXSHIFT | (o)))
 
-// turn a kernel linear address into a physical address.
-// all of the kernel data structures have linear and
-// physical addresses that are equal.
-#define PADDR(a)       ((uint)(a))
+// turn a kernel linear address into a physical address, and back.
+// the kernel sees physical memory at KERNBASE (see param.h), which
+// is 0 unless the build moves it.
+#define PADDR(a)       ((uint)(a) - KERNBASE)
+#define KADDR(pa)      ((void*)((uint)(pa) + KERNBASE))
 
 // Page directory and page table constants.
+#ifdef PAE
+#define NPDPTENTRIES	4		// entries in the page-directory-pointer table
+#define NPDENTRIES	2048		// page directory entries, all four directories
+#define NPTENTRIES	512		// page table entries per page table
+#else
 #define NPDENTRIES	1024		// page directory entries per page directory
 #define NPTENTRIES	1024		// page table entries per page table
+#endif
 
 #define PGSIZE		4096		// bytes mapped by a page
 #define PGSHIFT		12		// log2(PGSIZE)
 
 
 #define PTXSHIFT	12		// offset of PTX in a linear address
+#ifdef PAE
+#define PDXSHIFT	21		// offset of PDX in a linear address
+#else
 #define PDXSHIFT	22		// offset of PDX in a linear address
+#endif
 
 #define PGROUNDUP(sz)  (((sz)+PGSIZE-1) & ~(PGSIZE-1))
 #define PGROUNDDOWN(a) ((char*)((((unsigned int)(a)) & ~(PGSIZE-1))))
@@ -148,11 +182,25 @@ struct segdesc {
 #define PTE_PS		0x080	// Page Size
 #define PTE_MBZ		0x180	// Bits must be zero
 #define PTE_SWP     0x200   // Swapped
+#define PTE_ZERO    0x400   // Zero-filled on demand
+#define PTE_SHR     0x800   // Shared by page merging, copy on write
+
+// Page fault error code flags.
+#define FEC_PR      0x1     // Page fault caused by protection violation
+#define FEC_WR      0x2     // Page fault caused by a write
+#define FEC_U       0x4     // Page fault occured while in user mode
 
 // Address in page table or page directory entry
 #define PTE_ADDR(pte)	((uint)(pte) & ~0xFFF)
 
-typedef uint pte_t;
+// What to load into CR3 for page directory pgdir.  In PAE mode the
+// page-directory-pointer table is in the page below pgdir.
+#ifdef PAE
+#define PDPT(pgdir)	((pde_t*)((uint)(pgdir) - PGSIZE))
+#define CR3(pgdir)	PADDR(PDPT(pgdir))
+#else
+#define CR3(pgdir)	PADDR(pgdir)
+#endif
 
 // Task state segment format
 struct taskstate {
@@ -58,16 +58,16 @@ mpsearch(void)
   uint p;
   struct mp *mp;
 
-  bda = (uchar*)0x400;
+  bda = (uchar*)KADDR(0x400);
   if((p = ((bda[0x0F]<<8)|bda[0x0E]) << 4)){
-    if((mp = mpsearch1((uchar*)p, 1024)))
+    if((mp = mpsearch1((uchar*)KADDR(p), 1024)))
       return mp;
   } else {
     p = ((bda[0x14]<<8)|bda[0x13])*1024;
-    if((mp = mpsearch1((uchar*)p-1024, 1024)))
+    if((mp = mpsearch1((uchar*)KADDR(p-1024), 1024)))
       return mp;
   }
-  return mpsearch1((uchar*)0xF0000, 0x10000);
+  return mpsearch1((uchar*)KADDR(0xF0000), 0x10000);
 }
 
 // Search for an MP configuration table.  For now,
@@ -83,7 +83,7 @@ mpconfig(struct mp **pmp)
 
   if((mp = mpsearch()) == 0 || mp->physaddr == 0)
     return 0;
-  conf = (struct mpconf*)mp->physaddr;
+  conf = (struct mpconf*)KADDR(mp->physaddr);
   if(memcmp(conf, "PCMP", 4) != 0)
     return 0;
   if(conf->version != 1 && conf->version != 4)
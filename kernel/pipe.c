@@ -94,10 +94,13 @@ pipewrite(struct pipe *p, char *addr, int n)
   return n;
 }
 
+// The bytes are gathered into buf and copied out to addr only after
+// p->lock is released: a fault on addr under the lock would panic.
 int
 piperead(struct pipe *p, char *addr, int n)
 {
   int i;
+  char buf[PIPESIZE];
 
   acquire(&p->lock);
   while(p->nread == p->nwrite && p->writeopen){  //DOC: pipe-empty
@@ -110,9 +113,11 @@ piperead(struct pipe *p, char *addr, int n)
   for(i = 0; i < n; i++){  //DOC: piperead-copy
     if(p->nread == p->nwrite)
       break;
-    addr[i] = p->data[p->nread++ % PIPESIZE];
+    buf[i] = p->data[p->nread++ % PIPESIZE];
   }
   wakeup(&p->nwrite);  //DOC: piperead-wakeup
   release(&p->lock);
+  if(prefault((uint)addr, i) < 0 || copyout(proc->pgdir, (uint)addr, buf, i) < 0)
+    return -1;
   return i;
 }
@@ -5,23 +5,437 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "traps.h"
+#include "schedstat.h"
+#include "ktimer.h"
+#include "vdso.h"
 
 struct {
   struct spinlock lock;
   struct proc proc[NPROC];
 } ptable;
 
+// Per-CPU run queues.  Every RUNNABLE process is on exactly one of
+// them, put there by makerunnable().  A CPU runs the processes on its
+// own queue in turn, and takes one from the busiest other queue when
+// its own is empty.  A queue's lock is taken after ptable.lock or on
+// its own, and never together with another queue's.
+//
+// Each queue is a multi-level feedback queue: a process waits at its
+// priority level, and the highest non-empty level runs first.  At
+// level l a process gets a time slice of QUANTUM(l) ticks, counted
+// across sleeps so that giving up the CPU just before the tick does
+// not keep it on top; when the slice is used up it moves down a
+// level.  Every BOOSTTICKS ticks schedboost() moves everyone back up
+// to its nice() level, so that nothing starves.
+//
+// Under the fair class (make SCHED=fair, or sched=fair on a multiboot
+// command line) each queue is instead a min-heap ordered by virtual
+// runtime.  The running process's vruntime grows by VTICK(weight) a
+// tick, more slowly the heavier it is, and the process with the least
+// runs next, so processes get CPU time in proportion to their
+// setweight() weights.  A process is preempted once it is more than
+// one default-weight tick ahead of the head of its queue.  A queue's
+// minvruntime only moves forward, following the least vruntime of its
+// processes; one that wakes up is put no further than a tick behind
+// it, so sleeping does not bank CPU time.
+#define QUANTUM(l)  (1 << (l))
+#define BOOSTTICKS  100
+#define NICE0WEIGHT 1024
+#define MAXWEIGHT   (64*NICE0WEIGHT)
+#define VTICK(w)    (NICE0WEIGHT*NICE0WEIGHT / (w))
+
+struct runq {
+  struct spinlock lock;
+  struct proc *head[NMLFQ], *tail[NMLFQ];  // MLFQ levels
+  struct proc *heap[NPROC];    // fair class
+  uint64 minvruntime;          // fair class
+  int n;                       // length, read without the lock as a hint
+};
+static struct runq runq[NCPU];
+
+#define SCHED_MLFQ  0
+#define SCHED_FAIR  1
+static int schedclass;
+
+// Each CPU counts its own, without a lock; schedstat() adds them up.
+static struct schedstat schedstats[NCPU];
+
+// Sleeping processes, in wait queues hashed by channel, in the order
+// they went to sleep, so that a wakeup looks only at the processes
+// sleeping on channels with the same hash.  Guarded by ptable.lock,
+// like p->state; p->next links a process into its wait queue, as it
+// does into a run queue while RUNNABLE.
+#define NWAITQ 64
+
+static struct waitq {
+  struct proc *head, *tail;
+} waitq[NWAITQ];
+
+static struct waitq*
+waitqof(void *chan)
+{
+  return &waitq[((uint)chan >> 2) % NWAITQ];
+}
+
 static struct proc *initproc;
 int nextpid = 1;
 extern void forkret(void);
 extern void trapret(void);
 
-static void wakeup1(void *chan);
+static void wakeup1(void *chan, int n);
+static void wakeproc(struct proc *p);
 
 void
 pinit(void)
 {
+  char *s;
+  int i;
+
   initlock(&ptable.lock, "ptable");
+  for(i = 0; i < NCPU; i++)
+    initlock(&runq[i].lock, "runq");
+#ifdef SCHED_FAIR_DEFAULT
+  schedclass = SCHED_FAIR;
+#else
+  schedclass = SCHED_MLFQ;
+#endif
+  for(s = bootcmdline(); *s; s++){
+    if(strncmp(s, "sched=fair", 10) == 0)
+      schedclass = SCHED_FAIR;
+    else if(strncmp(s, "sched=mlfq", 10) == 0)
+      schedclass = SCHED_MLFQ;
+  }
+  cprintf("scheduler: %s\n", schedclass == SCHED_FAIR ? "fair" : "mlfq");
+}
+
+// Add p to q: at the tail of its priority level, or into the heap by
+// vruntime under the fair class.  Caller holds q->lock.
+static void
+runqput(struct runq *q, struct proc *p)
+{
+  int i;
+
+  if(schedclass == SCHED_FAIR){
+    for(i = q->n; i > 0 && p->vruntime < q->heap[(i-1)/2]->vruntime; i = (i-1)/2)
+      q->heap[i] = q->heap[(i-1)/2];
+    q->heap[i] = p;
+    q->n++;
+    return;
+  }
+  p->next = 0;
+  if(q->tail[p->prio])
+    q->tail[p->prio]->next = p;
+  else
+    q->head[p->prio] = p;
+  q->tail[p->prio] = p;
+  q->n++;
+}
+
+// Take the process with the least vruntime out of q's heap, which
+// is not empty.  Caller holds q->lock.
+static struct proc*
+heappop(struct runq *q)
+{
+  struct proc *p, *last;
+  int i, c;
+
+  p = q->heap[0];
+  last = q->heap[--q->n];
+  for(i = 0; (c = 2*i+1) < q->n; i = c){
+    if(c+1 < q->n && q->heap[c+1]->vruntime < q->heap[c]->vruntime)
+      c++;
+    if(last->vruntime <= q->heap[c]->vruntime)
+      break;
+    q->heap[i] = q->heap[c];
+  }
+  q->heap[i] = last;
+  if(p->vruntime > q->minvruntime)
+    q->minvruntime = p->vruntime;
+  return p;
+}
+
+// Process queue c has something to run: if its CPU is halted in
+// idle(), send it a reschedule IPI, or else wake another idle CPU,
+// which will steal it.  Taking the idle flag means one IPI per
+// halt.  Interrupts must be off.
+static void
+kickidle(int c)
+{
+  int i;
+
+  if(c != cpu - cpus && xchg(&cpus[c].idle, 0)){
+    lapicipi(cpus[c].id, T_IRQ0 + IRQ_RESCHED);
+    return;
+  }
+  for(i = 0; i < ncpu; i++){
+    if(i != cpu - cpus && xchg(&cpus[i].idle, 0)){
+      lapicipi(cpus[i].id, T_IRQ0 + IRQ_RESCHED);
+      return;
+    }
+  }
+}
+
+// Nothing to run: halt with interrupts on until the next one, such
+// as the reschedule IPI that makerunnable() sends.  The idle flag is
+// set before the queues are looked at once more, so a process queued
+// meanwhile is either seen here or gets this CPU an IPI.  A tickless
+// timer is set for only what is due while halted (clock.c).
+static void
+idle(void)
+{
+  int i;
+
+  cli();
+  xchg(&cpu->idle, 1);
+  for(i = 0; i < ncpu; i++)
+    if(runq[i].n > 0)
+      break;
+  if(i == ncpu){
+    clockidle();
+    asm volatile("sti; hlt; cli");
+  }
+  xchg(&cpu->idle, 0);
+  if(i == ncpu)
+    clockwake();
+  sti();
+}
+
+// Make p RUNNABLE and queue it on the run queue of the CPU it last
+// ran on, whose cache may still hold its working set, or else on
+// this CPU's, and wake an idle CPU for it.  Caller holds ptable.lock.
+static void
+makerunnable(struct proc *p)
+{
+  struct runq *q;
+
+  p->state = RUNNABLE;
+  q = &runq[p->lastcpu >= 0 ? p->lastcpu : cpu - cpus];
+  acquire(&q->lock);
+  if(schedclass == SCHED_FAIR && p->vruntime + VTICK(NICE0WEIGHT) < q->minvruntime)
+    p->vruntime = q->minvruntime - VTICK(NICE0WEIGHT);
+  runqput(q, p);
+  release(&q->lock);
+  // A process that yields is picked up again by its own CPU.
+  if(p != proc)
+    kickidle(q - runq);
+}
+
+// Take the first process of the highest non-empty level of q, or
+// the one with the least vruntime, or return 0 if q is empty.
+static struct proc*
+runqpop(struct runq *q)
+{
+  struct proc *p;
+  int l;
+
+  p = 0;
+  acquire(&q->lock);
+  if(schedclass == SCHED_FAIR){
+    if(q->n > 0)
+      p = heappop(q);
+    release(&q->lock);
+    return p;
+  }
+  for(l = 0; l < NMLFQ; l++){
+    if((p = q->head[l]) != 0){
+      q->head[l] = p->next;
+      if(q->head[l] == 0)
+        q->tail[l] = 0;
+      p->next = 0;
+      q->n--;
+      break;
+    }
+  }
+  release(&q->lock);
+  return p;
+}
+
+// The next process for this CPU to run: the head of its own run
+// queue, or else one stolen from the longest other queue.  Returns 0
+// if every queue is empty.  The process stays RUNNABLE; nothing but
+// the scheduler changes that.
+static struct proc*
+runqget(void)
+{
+  struct runq *q, *busiest;
+  struct proc *p;
+  int i;
+
+  q = &runq[cpu - cpus];
+  if(q->n > 0 && (p = runqpop(q)) != 0)
+    return p;
+  busiest = 0;
+  for(i = 0; i < ncpu; i++)
+    if(runq[i].n > 0 && (busiest == 0 || runq[i].n > busiest->n))
+      busiest = &runq[i];
+  if(busiest == 0 || (p = runqpop(busiest)) == 0)
+    return 0;
+  if(busiest != q){
+    schedstats[cpu - cpus].steals++;
+    // Its vruntime meant something on the other queue only; start
+    // it level with this one.
+    if(schedclass == SCHED_FAIR){
+      acquire(&q->lock);
+      p->vruntime = q->minvruntime;
+      release(&q->lock);
+    }
+  }
+  return p;
+}
+
+// The timer interrupted the current process.  Count the tick against
+// its time slice, and return 1 if the slice is used up, after moving
+// the process down a level.  Under the fair class, charge the tick to
+// its vruntime instead, and return 1 if it is far enough ahead of the
+// next process on this CPU's queue.  Only this CPU changes the
+// running process's slice, level and vruntime, and its own counters,
+// so no ptable.lock is needed; a boost on CPU 0 that races with the
+// tick at worst leaves one tick of slice uncounted.
+int
+schedtick(void)
+{
+  struct schedstat *s;
+  struct runq *q;
+  uint64 v;
+  int done;
+
+  done = 0;
+  pushcli();
+  s = &schedstats[cpu - cpus];
+  s->ticks[proc->prio]++;
+  if(schedclass == SCHED_FAIR){
+    proc->vruntime += VTICK(proc->weight);
+    q = &runq[cpu - cpus];
+    acquire(&q->lock);
+    v = proc->vruntime;
+    if(q->n > 0 && q->heap[0]->vruntime < v)
+      v = q->heap[0]->vruntime;
+    if(v > q->minvruntime)
+      q->minvruntime = v;
+    done = q->n > 0 && proc->vruntime > q->heap[0]->vruntime + VTICK(NICE0WEIGHT);
+    release(&q->lock);
+  } else if(++proc->slice >= QUANTUM(proc->prio)){
+    proc->slice = 0;
+    if(proc->prio < NMLFQ-1){
+      s->demotions[proc->prio]++;
+      proc->prio++;
+    }
+    done = 1;
+  }
+  popcli();
+  return done;
+}
+
+// Move every process back up to its nice() level with a fresh time
+// slice, re-queueing the RUNNABLE ones.  Called from the timer
+// interrupt on CPU 0 every tick, and acts every BOOSTTICKS ticks
+// (ticks can jump by more than one after a tickless idle).
+void
+schedboost(void)
+{
+  static uint lastboost;
+  struct proc *p, *list, **pp;
+  struct runq *q;
+  int l;
+
+  if(ticks - lastboost < BOOSTTICKS || schedclass == SCHED_FAIR)
+    return;
+  lastboost = ticks;
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    p->prio = p->nice;
+    p->slice = 0;
+  }
+  for(q = runq; q < &runq[ncpu]; q++){
+    acquire(&q->lock);
+    // Chain the levels together, highest first, and queue them
+    // again in that order at their new levels.
+    list = 0;
+    pp = &list;
+    for(l = 0; l < NMLFQ; l++){
+      *pp = q->head[l];
+      if(q->tail[l])
+        pp = &q->tail[l]->next;
+      q->head[l] = q->tail[l] = 0;
+    }
+    q->n = 0;
+    while((p = list) != 0){
+      list = p->next;
+      runqput(q, p);
+    }
+    release(&q->lock);
+  }
+  schedstats[cpu - cpus].boosts++;
+  release(&ptable.lock);
+}
+
+// Change the current process's nice value by inc, within 0 to
+// NMLFQ-1, and return the new value.  It is the highest level the
+// process runs at: schedboost() moves it back up only that far.
+int
+nice(int inc)
+{
+  int n;
+
+  if(inc > NMLFQ)
+    inc = NMLFQ;
+  if(inc < -NMLFQ)
+    inc = -NMLFQ;
+  acquire(&ptable.lock);
+  n = proc->nice + inc;
+  if(n < 0)
+    n = 0;
+  if(n > NMLFQ-1)
+    n = NMLFQ-1;
+  proc->nice = n;
+  if(proc->prio < n){
+    proc->prio = n;
+    proc->slice = 0;
+  }
+  release(&ptable.lock);
+  return n;
+}
+
+// Set the current process's weight under the fair class, within 1 to
+// MAXWEIGHT, unless weight is 0 or less, and return the old one.
+// NICE0WEIGHT is the default.
+int
+setweight(int weight)
+{
+  int old;
+
+  if(weight > MAXWEIGHT)
+    weight = MAXWEIGHT;
+  acquire(&ptable.lock);
+  old = proc->weight;
+  if(weight > 0)
+    proc->weight = weight;
+  release(&ptable.lock);
+  return old;
+}
+
+// Add up the scheduler statistics of all CPUs.
+void
+schedstat(struct schedstat *s)
+{
+  struct schedstat *c;
+  int i, l;
+
+  memset(s, 0, sizeof(*s));
+  for(c = schedstats; c < &schedstats[ncpu]; c++){
+    for(l = 0; l < NMLFQ; l++){
+      s->runs[l] += c->runs[l];
+      s->ticks[l] += c->ticks[l];
+      s->demotions[l] += c->demotions[l];
+    }
+    s->boosts += c->boosts;
+    s->steals += c->steals;
+  }
+  s->fair = schedclass == SCHED_FAIR;
+  s->ncpu = ncpu;
+  for(i = 0; i < ncpu; i++)
+    s->idle[i] = cpus[i].idleticks;
 }
 
 // Look in the process table for an UNUSED proc.
@@ -44,6 +458,17 @@ allocproc(void)
 found:
   p->state = EMBRYO;
   p->pid = nextpid++;
+  p->swappable = 0;
+  p->fpuused = 0;
+  p->fpucpu = -1;
+  p->hugeheap = -1;
+  p->lastcpu = -1;
+  p->nice = 0;
+  p->prio = 0;
+  p->slice = 0;
+  p->weight = NICE0WEIGHT;
+  p->vruntime = 0;
+  p->timedout = 0;
   release(&ptable.lock);
 
   // Allocate kernel stack if possible.
@@ -80,7 +505,7 @@ userinit(void)
   p = allocproc();
   acquire(&ptable.lock);
   initproc = p;
-  if((p->pgdir = setupkvm()) == 0)
+  if((p->pgdir = setupuvm(0)) == 0)
     panic("userinit: out of memory?");
   inituvm(p->pgdir, _binary_initcode_start, (int)_binary_initcode_size);
   p->sz = PGSIZE;
@@ -89,6 +514,7 @@ userinit(void)
   p->tf->ds = (SEG_UDATA << 3) | DPL_USER;
   p->tf->es = p->tf->ds;
   p->tf->ss = p->tf->ds;
+  p->tf->fs = (SEG_UCPU << 3) | DPL_USER;  // see vdso.c
   p->tf->eflags = FL_IF;
   p->tf->esp = PGSIZE;
   p->tf->eip = 0;  // beginning of initcode.S
@@ -96,7 +522,24 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  makerunnable(p);
+  release(&ptable.lock);
+}
+
+// Start a kernel process running fn(), which must not return.  It
+// has an empty user address space and no parent.
+void
+kproc(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0 || (p->pgdir = setupuvm(0)) == 0)
+    panic("kproc");
+  // forkret() returns to fn instead of trapret.
+  *(uint*)(p->context + 1) = (uint)fn;
+  safestrcpy(p->name, name, sizeof(p->name));
+  acquire(&ptable.lock);
+  makerunnable(p);
   release(&ptable.lock);
 }
 
@@ -105,21 +548,89 @@ userinit(void)
 int
 growproc(int n)
 {
-  uint sz;
+  uint sz, top;
   
+  struct proc *p;
+  
+  // Other threads may be growing the same address space.
+  vmlock(proc->pgdir);
   sz = proc->sz;
+  // The heap stays below the stack, however far USERTOP is.
+  if(n > 0 && proc->stack && sz + n > (uint)proc->stack){
+    vmunlock(proc->pgdir);
+    return -1;
+  }
+  proc->swappable = 1;
   if(n > 0){
-    if((sz = allocuvm(proc->pgdir, sz, sz + n)) == 0)
-      return -1;
+    // Past the huge heap threshold, reserve up to the next huge
+    // page boundary, so that the heap grows in whole huge pages
+    // from there on; zerouvm() skips what is already reserved.
+    top = sz + n;
+    if(proc->hugeheap >= 0 && sz >= (uint)proc->hugeheap){
+      top = ROUNDUP(sz + n, MAXSIZE);
+      if(top > USERTOP || (proc->stack && top > (uint)proc->stack))
+        top = sz + n;
+    }
+    if(zerouvm(proc->pgdir, sz, top) == 0)
+      sz = 0;
+    else
+      sz += n;
   } else if(n < 0){
-    if((sz = deallocuvm(proc->pgdir, sz, sz + n)) == 0)
-      return -1;
+    // Give back the huge heap's reservation above the old break too.
+    top = ROUNDUP(sz, MAXSIZE);
+    if(top > USERTOP || (proc->stack && top > (uint)proc->stack))
+      top = sz;
+    sz = deallocuvm(proc->pgdir, top, sz + n);
   }
-  proc->sz = sz;
+  proc->swappable = 0;
+  if(sz == 0){
+    vmunlock(proc->pgdir);
+    return -1;
+  }
+  // Threads sharing the address space see the new size too.
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    if(p->pgdir == proc->pgdir)
+      p->sz = sz;
+  release(&ptable.lock);
+  vmunlock(proc->pgdir);
   switchuvm(proc);
   return 0;
 }
 
+// A fault at va with the user stack pointer at esp: grow the current
+// process's stack down a page if both are on the page below it,
+// keeping clear of the heap.  Return 0 if va is on the stack now, -1
+// if not.
+int
+growstack(uint esp, uint va)
+{
+  uint new_stack;
+  struct proc *p;
+
+  vmlock(proc->pgdir);
+  // Another thread may have grown it already.
+  if(va >= (uint)proc->stack && va < USERTOP && esp < USERTOP){
+    vmunlock(proc->pgdir);
+    return 0;
+  }
+  new_stack = (uint)proc->stack - PGSIZE;
+  if(esp < new_stack || va < new_stack || esp >= USERTOP ||
+     proc->sz + 5*PGSIZE > new_stack ||
+     allocuvm(proc->pgdir, new_stack, new_stack + PGSIZE) == 0){
+    vmunlock(proc->pgdir);
+    return -1;
+  }
+  // Threads sharing the address space see the new stack too.
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    if(p->pgdir == proc->pgdir)
+      p->stack = (char*)new_stack;
+  release(&ptable.lock);
+  vmunlock(proc->pgdir);
+  return 0;
+}
+
 // Create a new process copying p as the parent.
 // Sets up stack to return as if from system call.
 // Caller must set state of returned proc to RUNNABLE.
@@ -133,16 +644,21 @@ fork(void)
   if((np = allocproc()) == 0)
     return -1;
 
-  // Copy process state from p.
-  if((np->pgdir = copyuvm(proc->pgdir, proc->sz)) == 0){
+  // Copy process state from p, with no thread changing its layout.
+  vmlock(proc->pgdir);
+  if((np->pgdir = copyuvm(proc->pgdir)) == 0){
+    vmunlock(proc->pgdir);
     kfree(np->kstack);
     np->kstack = 0;
     np->state = UNUSED;
     return -1;
   }
   np->sz = proc->sz;
+  np->stack = proc->stack;
+  vmunlock(proc->pgdir);
   np->parent = proc;
   *np->tf = *proc->tf;
+  fpufork(np);
 
   // Clear %eax so that fork returns 0 in the child.
   np->tf->eax = 0;
@@ -153,9 +669,83 @@ fork(void)
   np->cwd = idup(proc->cwd);
  
   pid = np->pid;
-  np->state = RUNNABLE;
+  np->hugeheap = proc->hugeheap;
+  np->nice = np->prio = proc->nice;
+  np->weight = proc->weight;
+  np->vruntime = proc->vruntime;
+  safestrcpy(np->name, proc->name, sizeof(proc->name));
+  acquire(&ptable.lock);
+  makerunnable(np);
+  release(&ptable.lock);
+  return pid;
+}
+
+// Create a new thread running fn(arg) on the one-page user stack
+// at stack.  The thread shares the caller's address space and
+// open files.  Returns the new thread's pid, or -1 on error.
+int
+clone(void (*fn)(void*), void *arg, void *stack)
+{
+  int i, pid;
+  uint sp, ustack[2];
+  struct proc *np;
+
+  if((uint)stack % PGSIZE != 0)
+    return -1;
+
+  // Allocate process.
+  if((np = allocproc()) == 0)
+    return -1;
+
+  // Once np->pgdir is set, growproc() and stack growth in the other
+  // threads keep np->sz and np->stack up to date.
+  vmlock(proc->pgdir);
+  if((uint)stack + PGSIZE > proc->sz || vmunshare(proc->pgdir) < 0){
+    vmunlock(proc->pgdir);
+    kfree(np->kstack);
+    np->kstack = 0;
+    np->state = UNUSED;
+    return -1;
+  }
+  vmshare(proc->pgdir);
+  np->pgdir = proc->pgdir;
+  np->sz = proc->sz;
   np->stack = proc->stack;
+  vmunlock(proc->pgdir);
+  np->hugeheap = proc->hugeheap;
+  np->nice = np->prio = proc->nice;
+  np->weight = proc->weight;
+  np->vruntime = proc->vruntime;
+  np->ustack = stack;
+  np->parent = proc;
+  *np->tf = *proc->tf;
+
+  // Start at fn with arg on the new stack, as if fn had been
+  // called; returning from fn faults on the fake return PC.
+  ustack[0] = 0xffffffff;
+  ustack[1] = (uint)arg;
+  sp = (uint)stack + PGSIZE - sizeof(ustack);
+  if(prefault(sp, sizeof(ustack)) < 0 ||
+     copyout(np->pgdir, sp, ustack, sizeof(ustack)) < 0){
+    freevm(np->pgdir);
+    kfree(np->kstack);
+    np->kstack = 0;
+    np->state = UNUSED;
+    return -1;
+  }
+  np->tf->esp = sp;
+  np->tf->eip = (uint)fn;
+
+  for(i = 0; i < NOFILE; i++)
+    if(proc->ofile[i])
+      np->ofile[i] = filedup(proc->ofile[i]);
+  np->cwd = idup(proc->cwd);
+
+  pid = np->pid;
   safestrcpy(np->name, proc->name, sizeof(proc->name));
+  acquire(&ptable.lock);
+  makerunnable(np);
+  release(&ptable.lock);
   return pid;
 }
 
@@ -185,14 +775,20 @@ exit(void)
   acquire(&ptable.lock);
 
   // Parent might be sleeping in wait().
-  wakeup1(proc->parent);
+  wakeup1(proc->parent, -1);
 
-  // Pass abandoned children to init.
+  // Pass abandoned children to init.  Threads of an exiting
+  // process are killed; init reaps them once they exit.
   for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
     if(p->parent == proc){
+      if(p->pgdir == proc->pgdir && proc->ustack == 0){
+        p->killed = 1;
+        if(p->state == SLEEPING)
+          wakeproc(p);
+      }
       p->parent = initproc;
       if(p->state == ZOMBIE)
-        wakeup1(initproc);
+        wakeup1(initproc, -1);
     }
   }
 
@@ -204,6 +800,7 @@ exit(void)
 
 // Wait for a child process to exit and return its pid.
 // Return -1 if this process has no children.
+// Threads are not children in this sense; see join().
 int
 wait(void)
 {
@@ -215,7 +812,7 @@ wait(void)
     // Scan through table looking for zombie children.
     havekids = 0;
     for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->parent != proc)
+      if(p->parent != proc || p->pgdir == proc->pgdir)
         continue;
       havekids = 1;
       if(p->state == ZOMBIE){
@@ -229,6 +826,7 @@ wait(void)
         p->parent = 0;
         p->name[0] = 0;
         p->killed = 0;
+        p->ustack = 0;
         release(&ptable.lock);
         return pid;
       }
@@ -241,17 +839,175 @@ wait(void)
     }
 
     // Wait for children to exit.  (See wakeup1 call in proc_exit.)
+    proc->swappable = 1;
     sleep(proc, &ptable.lock);  //DOC: wait-sleep
+    proc->swappable = 0;
   }
 }
 
+// Wait for a thread created by this process with clone() to exit.
+// Stores the thread's user stack in *stack so the caller can free
+// it, and returns its pid.  Return -1 if there are no threads.
+// *stack is written only after ptable.lock is released: a sibling
+// thread may have unmapped it, and a fault under a spinlock panics.
+int
+join(void **stack)
+{
+  struct proc *p;
+  int havekids, pid;
+  void *ustack;
+
+  acquire(&ptable.lock);
+  for(;;){
+    // Scan through table looking for zombie threads.
+    havekids = 0;
+    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+      if(p->parent != proc || p->pgdir != proc->pgdir)
+        continue;
+      havekids = 1;
+      if(p->state == ZOMBIE){
+        // Found one.
+        pid = p->pid;
+        ustack = p->ustack;
+        kfree(p->kstack);
+        p->kstack = 0;
+        freevm(p->pgdir);
+        p->state = UNUSED;
+        p->pid = 0;
+        p->parent = 0;
+        p->name[0] = 0;
+        p->killed = 0;
+        p->ustack = 0;
+        release(&ptable.lock);
+        if(prefault((uint)stack, sizeof(ustack)) < 0 ||
+           copyout(proc->pgdir, (uint)stack, &ustack, sizeof(ustack)) < 0)
+          return -1;
+        return pid;
+      }
+    }
+
+    // No point waiting if we don't have any threads.
+    if(!havekids || proc->killed){
+      release(&ptable.lock);
+      return -1;
+    }
+
+    // Wait for threads to exit.
+    sleep(proc, &ptable.lock);
+  }
+}
+
+// The number of live processes using pgdir.  Caller holds
+// ptable.lock.
+static int
+nthreads(pde_t *pgdir)
+{
+  struct proc *p;
+  int n;
+
+  n = 0;
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    if(p->state != UNUSED && p->state != ZOMBIE && p->pgdir == pgdir)
+      n++;
+  return n;
+}
+
+// Can the pages of pgdir be swapped out now?  Not while a thread
+// using it runs on another CPU, whose TLB we cannot flush, or sits
+// in the kernel with pointers into user memory.
+static int
+evictable(pde_t *pgdir)
+{
+  struct proc *p;
+
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p->state == UNUSED || p->state == ZOMBIE || p->pgdir != pgdir)
+      continue;
+    if((p->state == RUNNING && p != proc) || !p->swappable)
+      return 0;
+  }
+  return 1;
+}
+
+// Return the address space of process table slot i with a
+// reference held, if its pages can be swapped out now; otherwise 0.
+// The caller drops the reference with freevm().
+pde_t*
+swapvictim(int i)
+{
+  struct proc *p;
+  pde_t *pgdir;
+
+  acquire(&ptable.lock);
+  p = &ptable.proc[i];
+  pgdir = 0;
+  if(p->state != UNUSED && p->state != ZOMBIE && p->pgdir &&
+     evictable(p->pgdir)){
+    pgdir = p->pgdir;
+    vmshare(pgdir);
+  }
+  release(&ptable.lock);
+  return pgdir;
+}
+
+// Lock the process table, so no thread of pgdir can start running,
+// and return 1 if its pages may be swapped out.  Otherwise return 0
+// without the lock.  Release with swapunlock().
+int
+swaplock(pde_t *pgdir)
+{
+  acquire(&ptable.lock);
+  if(evictable(pgdir))
+    return 1;
+  release(&ptable.lock);
+  return 0;
+}
+
+void
+swapunlock(void)
+{
+  release(&ptable.lock);
+}
+
+// With the process table locked, may the pages of pgdir be
+// changed under its threads, as by frameremap() in vm.c?  Only if
+// some process uses it, so that it is not being torn down, and it
+// could be swapped out.
+int
+swapalso(pde_t *pgdir)
+{
+  return nthreads(pgdir) > 0 && evictable(pgdir);
+}
+
+// With the process table locked, may the pages of pgdir be merged
+// with others (see ksm.c)?  Only if swapalso(), and it has a single
+// thread.
+int
+mergealso(pde_t *pgdir)
+{
+  return nthreads(pgdir) == 1 && evictable(pgdir);
+}
+
+// Like swaplock(), for merging the pages of pgdir.
+int
+mergelock(pde_t *pgdir)
+{
+  acquire(&ptable.lock);
+  if(mergealso(pgdir))
+    return 1;
+  release(&ptable.lock);
+  return 0;
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run
+//  - take a process off the run queues
 //  - swtch to start running that process
 //  - eventually that process transfers control
 //      via swtch back to the scheduler.
+// Only the run queue locks are taken while looking for work;
+// ptable.lock is taken once a process has been found.
 void
 scheduler(void)
 {
@@ -261,27 +1017,35 @@ scheduler(void)
     // Enable interrupts on this processor.
     sti();
 
-    // Loop over process table looking for process to run.
+    if((p = runqget()) == 0){
+      idle();
+      continue;
+    }
+
+    // A process that has just queued itself (yield(), sleep() and
+    // a wakeup) may still be switching out on another CPU; it holds
+    // ptable.lock until its context is saved.
     acquire(&ptable.lock);
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->state != RUNNABLE)
-        continue;
+    if(p->state != RUNNABLE)
+      panic("scheduler");
 
-      // Switch to chosen process.  It is the process's job
-      // to release ptable.lock and then reacquire it
-      // before jumping back to us.
-      proc = p;
-      switchuvm(p);
-      p->state = RUNNING;
-      swtch(&cpu->scheduler, proc->context);
-      switchkvm();
-
-      // Process is done running for now.
-      // It should have changed its p->state before coming back.
-      proc = 0;
-    }
-    release(&ptable.lock);
+    // Switch to chosen process.  It is the process's job
+    // to release ptable.lock and then reacquire it
+    // before jumping back to us.
+    proc = p;
+    p->lastcpu = cpu - cpus;
+    schedstats[cpu - cpus].runs[p->prio]++;
+    vdso->cpu[cpu - cpus].pid = p->pid;
+    switchuvm(p);
+    fpuenter(p);
+    p->state = RUNNING;
+    swtch(&cpu->scheduler, proc->context);
+    switchkvm();
 
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    proc = 0;
+    release(&ptable.lock);
   }
 }
 
@@ -301,6 +1065,7 @@ sched(void)
   if(readeflags()&FL_IF)
     panic("sched interruptible");
   intena = cpu->intena;
+  fpuleave();
   swtch(&proc->context, cpu->scheduler);
   cpu->intena = intena;
 }
@@ -310,7 +1075,7 @@ void
 yield(void)
 {
   acquire(&ptable.lock);  //DOC: yieldlock
-  proc->state = RUNNABLE;
+  makerunnable(proc);
   sched();
   release(&ptable.lock);
 }
@@ -327,10 +1092,16 @@ forkret(void)
 }
 
 // Atomically release lock and sleep on chan.
-// Reacquires lock when awakened.
-void
-sleep(void *chan, struct spinlock *lk)
+// Reacquires lock when awakened.  A timed sleep, which only a timer
+// the caller has set would otherwise end, does not start once the
+// process has been killed: kill() wakes only processes already
+// asleep, and the caller may have looked at proc->killed just before
+// kill() set it.
+static void
+sleep1(void *chan, struct spinlock *lk, int timed)
 {
+  struct waitq *q;
+
   if(proc == 0)
     panic("sleep");
 
@@ -348,10 +1119,20 @@ sleep(void *chan, struct spinlock *lk)
     release(lk);
   }
 
-  // Go to sleep.
-  proc->chan = chan;
-  proc->state = SLEEPING;
-  sched();
+  // Go to sleep, at the end of chan's wait queue, unless the
+  // timeout of a sleeptimeout() has already run out.
+  if(!proc->timedout && !(timed && proc->killed)){
+    q = waitqof(chan);
+    proc->next = 0;
+    if(q->tail)
+      q->tail->next = proc;
+    else
+      q->head = proc;
+    q->tail = proc;
+    proc->chan = chan;
+    proc->state = SLEEPING;
+    sched();
+  }
 
   // Tidy up.
   proc->chan = 0;
@@ -363,16 +1144,102 @@ sleep(void *chan, struct spinlock *lk)
   }
 }
 
-// Wake up all processes sleeping on chan.
-// The ptable lock must be held.
-static void
-wakeup1(void *chan)
+void
+sleep(void *chan, struct spinlock *lk)
+{
+  sleep1(chan, lk, 0);
+}
+
+// Like sleep(), for a sleep that only the caller's timer ends, as in
+// nanosleep().  Returns at once if the process has been killed.
+void
+sleeptimed(void *chan, struct spinlock *lk)
+{
+  sleep1(chan, lk, 1);
+}
+
+// Timer callback for sleeptimeout() and nanosleep(): end p's sleep,
+// or the one it is about to start.
+void
+sleepexpire(void *arg)
 {
   struct proc *p;
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == SLEEPING && p->chan == chan)
-      p->state = RUNNABLE;
+  p = arg;
+  acquire(&ptable.lock);
+  p->timedout = 1;
+  if(p->state == SLEEPING)
+    wakeproc(p);
+  release(&ptable.lock);
+}
+
+// Like sleep(), but wake up after n ticks at the latest.  Returns 0
+// if woken before that, -1 if the time ran out.  lk must not be
+// ptable.lock.
+int
+sleeptimeout(void *chan, struct spinlock *lk, uint n)
+{
+  struct ktimer t;
+  int timedout;
+
+  ktimeradd(&t, n, sleepexpire, proc);
+  sleeptimed(chan, lk);
+  ktimerdel(&t);
+  // The callback has run or never will; no lock needed.
+  timedout = proc->timedout;
+  proc->timedout = 0;
+  return timedout ? -1 : 0;
+}
+
+// Take p, which sleeps on p->chan, out of its wait queue, whose
+// entry before it is prev (0 if p is the first), and make it
+// RUNNABLE.  The ptable lock must be held.
+static void
+wakeunlink(struct waitq *q, struct proc *prev, struct proc *p)
+{
+  if(prev)
+    prev->next = p->next;
+  else
+    q->head = p->next;
+  if(q->tail == p)
+    q->tail = prev;
+  makerunnable(p);
+}
+
+// Wake up the first n processes sleeping on chan, or all of them
+// if n < 0.  The ptable lock must be held.
+static void
+wakeup1(void *chan, int n)
+{
+  struct waitq *q;
+  struct proc *p, *prev, *next;
+
+  q = waitqof(chan);
+  prev = 0;
+  for(p = q->head; p && n != 0; p = next){
+    next = p->next;
+    if(p->chan != chan){
+      prev = p;
+      continue;
+    }
+    wakeunlink(q, prev, p);
+    n--;
+  }
+}
+
+// Wake up p, whatever it sleeps on.  The ptable lock must be held.
+static void
+wakeproc(struct proc *p)
+{
+  struct waitq *q;
+  struct proc *prev;
+
+  q = waitqof(p->chan);
+  prev = 0;
+  if(q->head != p)
+    for(prev = q->head; prev->next != p; prev = prev->next)
+      ;
+  wakeunlink(q, prev, p);
 }
 
 // Wake up all processes sleeping on chan.
@@ -380,7 +1247,18 @@ void
 wakeup(void *chan)
 {
   acquire(&ptable.lock);
-  wakeup1(chan);
+  wakeup1(chan, -1);
+  release(&ptable.lock);
+}
+
+// Wake up the process that has slept longest on chan.  Enough when
+// whoever is woken either takes what it waited for, and so wakes
+// the next when it gives it back, or sleeps again.
+void
+wakeupone(void *chan)
+{
+  acquire(&ptable.lock);
+  wakeup1(chan, 1);
   release(&ptable.lock);
 }
 
@@ -398,7 +1276,7 @@ kill(int pid)
       p->killed = 1;
       // Wake process from sleep if necessary.
       if(p->state == SLEEPING)
-        p->state = RUNNABLE;
+        wakeproc(p);
       release(&ptable.lock);
       return 0;
     }
@@ -407,6 +1285,30 @@ kill(int pid)
   return -1;
 }
 
+// Kill the other threads using pgdir, for exec().  Threads of the
+// current process are handed to init, which reaps them as they exit,
+// so that they do not turn up in wait() in the new image.
+void
+killthreads(pde_t *pgdir)
+{
+  struct proc *p;
+
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p == proc || p->state == UNUSED || p->pgdir != pgdir)
+      continue;
+    p->killed = 1;
+    if(p->state == SLEEPING)
+      wakeproc(p);
+    if(p->parent == proc){
+      p->parent = initproc;
+      if(p->state == ZOMBIE)
+        wakeup1(initproc, -1);
+    }
+  }
+  release(&ptable.lock);
+}
+
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
 // No lock to avoid wedging a stuck machine further.
@@ -2,13 +2,15 @@
 #define _PROC_H_
 // Segments in proc->gdt.
 // Also known to bootasm.S and trapasm.S
+// sysexit wants the user segments right after the kernel ones.
 #define SEG_KCODE 1  // kernel code
 #define SEG_KDATA 2  // kernel data+stack
-#define SEG_KCPU  3  // kernel per-cpu data
-#define SEG_UCODE 4  // user code
-#define SEG_UDATA 5  // user data+stack
+#define SEG_UCODE 3  // user code
+#define SEG_UDATA 4  // user data+stack
+#define SEG_KCPU  5  // kernel per-cpu data
 #define SEG_TSS   6  // this process's task state
-#define NSEGS     7
+#define SEG_UCPU  7  // user read-only per-cpu data (vdso.h)
+#define NSEGS     8
 
 // Per-CPU state
 struct cpu {
@@ -23,6 +25,10 @@ struct cpu {
   // Cpu-local storage variables; see below
   struct cpu *cpu;
   struct proc *proc;           // The currently-running process.
+
+  struct proc *fpuowner;       // Process whose FPU registers this CPU holds
+  volatile uint idle;          // Halted in idle(), waiting for an IPI
+  uint idleticks;              // Timer ticks with no process to run
 };
 
 extern struct cpu cpus[NCPU];
@@ -75,6 +81,20 @@ struct proc {
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
   char* stack;                 //stack pointer
+  char *ustack;                // User stack given to clone() (threads only)
+  int swappable;               // Holds no kernel pointers into user memory
+  int fpuused;                 // Has used the FPU; fpu holds its registers
+  int fpucpu;                  // CPU that last loaded its FPU registers
+  int hugeheap;                // sbrk() aligns to huge pages from this size; -1 if off
+  int lastcpu;                 // CPU it last ran on, or -1
+  struct proc *next;           // Next on its run queue or wait queue
+  int nice;                    // Highest priority level it runs at
+  int prio;                    // Priority level, 0 the highest
+  int slice;                   // Ticks used of its time slice at prio
+  int weight;                  // CPU share under the fair class
+  uint64 vruntime;             // Weighted CPU time under the fair class
+  int timedout;                // sleeptimeout() ran out of time
+  char fpu[512] __attribute__((aligned(16)));  // fxsave area
 };
 
 // Process memory is laid out contiguously, low addresses first:
@@ -82,5 +102,12 @@ struct proc {
 //   original data and bss
 //   fixed-size stack
 //   expandable heap
+//
+// Threads created by clone() share their creator's pgdir, sz and
+// open files, and run on a one-page user stack carved out of the heap.
+//
+// Pages of any part may be swapped out, but only while every thread
+// of the process is stopped at a point where the kernel holds no
+// pointers into its memory (swappable, see swapout() in vm.c).
 
 #endif // _PROC_H_
@@ -0,0 +1,185 @@
+// Reverse map: for every frame of user memory, the address spaces
+// and user addresses that map it.
+//
+// Nearly every frame is mapped just once, and that mapping is kept
+// in an array indexed by frame number.  A frame shared by page
+// merging (see ksm.c) keeps its further mappings on a list, with
+// entries from a fixed pool.  A huge page is recorded once, under
+// its first 4K frame.  The zero pages (see zerofault() in vm.c) are
+// mapped too widely to be worth recording and are left out.
+//
+// vm.c changes user page table entries and the reverse map together
+// under rmaplock() (see setpte()), and uses the map to move or drop
+// every mapping of a frame (frameremap(), frameunmap()).
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+
+#define NRMAP 4096  // further mappings of shared frames
+
+struct rmap {
+  pde_t *pgdir;                // 0 if none
+  uint va;
+  struct rmap *next;           // further mappings of the frame
+};
+
+static struct {
+  struct spinlock lock;
+  struct rmap *frame;          // one per frame below physend
+  struct rmap pool[NRMAP];
+  struct rmap *free;
+} rmap;
+
+// The frame array is sized for the memory there is, as the buddy
+// allocator's bitmaps are, and comes from the allocator itself.
+void
+rmapinit(void)
+{
+  struct rmap *r;
+  uint n;
+
+  initlock(&rmap.lock, "rmap");
+  n = physend / PGSIZE * sizeof(struct rmap);
+  if((rmap.frame = (struct rmap*)buddy_alloc(n)) == 0)
+    panic("rmapinit");
+  memset(rmap.frame, 0, n);
+  for(r = rmap.pool; r < &rmap.pool[NRMAP]; r++){
+    r->next = rmap.free;
+    rmap.free = r;
+  }
+}
+
+void
+rmaplock(void)
+{
+  acquire(&rmap.lock);
+}
+
+void
+rmapunlock(void)
+{
+  release(&rmap.lock);
+}
+
+// Record that pgdir maps the frame at pa at user address va.
+// Returns -1 if the pool is full.  Caller holds rmaplock().
+int
+rmapadd(uint pa, pde_t *pgdir, uint va)
+{
+  struct rmap *f, *r;
+
+  f = &rmap.frame[pa / PGSIZE];
+  if(f->pgdir == 0){
+    f->pgdir = pgdir;
+    f->va = va;
+    return 0;
+  }
+  if((r = rmap.free) == 0)
+    return -1;
+  rmap.free = r->next;
+  r->pgdir = pgdir;
+  r->va = va;
+  r->next = f->next;
+  f->next = r;
+  return 0;
+}
+
+// Forget that pgdir maps the frame at pa at va.
+// Caller holds rmaplock().
+void
+rmapdel(uint pa, pde_t *pgdir, uint va)
+{
+  struct rmap *f, *r, **pp;
+
+  f = &rmap.frame[pa / PGSIZE];
+  if(f->pgdir == pgdir && f->va == va){
+    if((r = f->next) == 0){
+      f->pgdir = 0;
+      return;
+    }
+    f->pgdir = r->pgdir;
+    f->va = r->va;
+    f->next = r->next;
+    r->next = rmap.free;
+    rmap.free = r;
+    return;
+  }
+  for(pp = &f->next; (r = *pp) != 0; pp = &r->next){
+    if(r->pgdir == pgdir && r->va == va){
+      *pp = r->next;
+      r->next = rmap.free;
+      rmap.free = r;
+      return;
+    }
+  }
+  panic("rmapdel");
+}
+
+// Replace the record of the huge page at pa, mapped at va in pgdir,
+// with records of its 4K frames.  Caller holds rmaplock().
+void
+rmapsplit(uint pa, pde_t *pgdir, uint va)
+{
+  int i;
+
+  rmapdel(pa, pgdir, va);
+  for(i = 0; i < NPTENTRIES; i++)
+    rmapadd(pa + i*PGSIZE, pgdir, va + i*PGSIZE);
+}
+
+// An address space mapping pa, or 0 if none does.
+// Caller holds rmaplock().
+pde_t*
+rmapfirst(uint pa)
+{
+  return rmap.frame[pa / PGSIZE].pgdir;
+}
+
+// Call f(pgdir, va, arg) for every mapping of the frame at pa,
+// stopping if it returns -1.  Returns -1 if f did, else 0.  f must
+// not change the reverse map.  Caller holds rmaplock().
+int
+rmapwalk(uint pa, int (*f)(pde_t*, uint, void*), void *arg)
+{
+  struct rmap *r;
+
+  r = &rmap.frame[pa / PGSIZE];
+  if(r->pgdir == 0)
+    return 0;
+  for(; r; r = r->next)
+    if(f(r->pgdir, r->va, arg) < 0)
+      return -1;
+  return 0;
+}
+
+// Move every mapping of the frame at pa to the unmapped frame at
+// newpa.  Caller holds rmaplock().
+void
+rmapmove(uint pa, uint newpa)
+{
+  struct rmap *f;
+
+  f = &rmap.frame[pa / PGSIZE];
+  rmap.frame[newpa / PGSIZE] = *f;
+  f->pgdir = 0;
+  f->next = 0;
+}
+
+// Forget every mapping of the frame at pa.
+// Caller holds rmaplock().
+void
+rmapclear(uint pa)
+{
+  struct rmap *f, *r;
+
+  f = &rmap.frame[pa / PGSIZE];
+  while((r = f->next) != 0){
+    f->next = r->next;
+    r->next = rmap.free;
+    rmap.free = r;
+  }
+  f->pgdir = 0;
+}
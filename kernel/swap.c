@@ -0,0 +1,152 @@
+// Swap space for user pages.
+//
+// The swap area is a run of NSWAPPG page-sized slots on disk
+// SWAPDEV, starting at sector SWAPSTART.  A swapped-out 4K page
+// takes one slot; a swapped-out huge page takes MAXPGSIZE/PGSIZE
+// contiguous slots aligned to that count, so it can be read back as
+// one extent or split into 4K pages later.
+//
+// Choosing victims and editing page tables is done by swapout() and
+// swapin() in vm.c; this file only manages slots and disk I/O.
+// Transfers bypass the buffer cache: swapped pages are never shared,
+// so caching them would only evict file system blocks.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "fs.h"
+#include "buf.h"
+
+#define SECTPERPG (PGSIZE / BSIZE)
+
+// lock guards the slot map and is taken with ptable.lock held (by
+// freevm() in wait()), so sleeping for busy needs a lock of its own.
+static struct {
+  struct spinlock lock;
+  uchar used[NSWAPPG / 8];     // one bit per slot
+  int nfree;                   // free slots
+  struct spinlock busylock;
+  int busy;                    // an eviction is in progress
+} swap;
+
+void
+swapinit(void)
+{
+  initlock(&swap.lock, "swap");
+  initlock(&swap.busylock, "swapbusy");
+  swap.nfree = NSWAPPG;
+  cprintf("swap: %d pages on disk %d at sector %d\n",
+          NSWAPPG, SWAPDEV, SWAPSTART);
+}
+
+static int
+slotused(int slot)
+{
+  return (swap.used[slot / 8] >> (slot % 8)) & 1;
+}
+
+// Allocate n contiguous slots, aligned to n.
+// Returns the first slot, or -1 if there is no room.
+int
+swapalloc(int n)
+{
+  int slot, i;
+
+  acquire(&swap.lock);
+  if(swap.nfree >= n){
+    for(slot = 0; slot + n <= NSWAPPG; slot += n){
+      for(i = 0; i < n; i++)
+        if(slotused(slot + i))
+          break;
+      if(i < n)
+        continue;
+      for(i = 0; i < n; i++)
+        swap.used[(slot + i) / 8] |= 1 << ((slot + i) % 8);
+      swap.nfree -= n;
+      release(&swap.lock);
+      return slot;
+    }
+  }
+  release(&swap.lock);
+  return -1;
+}
+
+void
+swapfree(int slot, int n)
+{
+  int i;
+
+  if(slot < 0 || slot + n > NSWAPPG)
+    panic("swapfree");
+  acquire(&swap.lock);
+  for(i = slot; i < slot + n; i++){
+    if(!slotused(i))
+      panic("swapfree: free slot");
+    swap.used[i / 8] &= ~(1 << (i % 8));
+  }
+  swap.nfree += n;
+  release(&swap.lock);
+}
+
+// Move n pages between mem and the slots starting at slot.
+static void
+swaprw(int slot, char *mem, int n, int write)
+{
+  struct buf b;
+  int i;
+
+  for(i = 0; i < n * SECTPERPG; i++){
+    b.dev = SWAPDEV;
+    b.sector = SWAPSTART + slot * SECTPERPG + i;
+    if(write){
+      memmove(b.data, mem + i * BSIZE, BSIZE);
+      b.flags = B_BUSY | B_DIRTY;
+    } else
+      b.flags = B_BUSY;
+    iderw(&b);
+    if(!write)
+      memmove(mem + i * BSIZE, b.data, BSIZE);
+  }
+}
+
+void
+swapread(int slot, char *mem, int n)
+{
+  swaprw(slot, mem, n, 0);
+}
+
+void
+swapwrite(int slot, char *mem, int n)
+{
+  swaprw(slot, mem, n, 1);
+}
+
+// Only one eviction runs at a time.  Returns 0 if the caller should
+// evict, or -1 after waiting for another eviction to finish, in
+// which case the caller should simply retry its allocation.
+int
+swapbegin(void)
+{
+  acquire(&swap.busylock);
+  if(swap.busy){
+    while(swap.busy)
+      sleep(&swap.busy, &swap.busylock);
+    release(&swap.busylock);
+    return -1;
+  }
+  swap.busy = 1;
+  release(&swap.busylock);
+  return 0;
+}
+
+void
+swapend(void)
+{
+  acquire(&swap.busylock);
+  swap.busy = 0;
+  wakeup(&swap.busy);
+  release(&swap.busylock);
+}
@@ -19,6 +19,8 @@ fetchint(struct proc *p, uint addr, int *ip)
 {
   if((addr >= p->sz || addr+4 > p->sz) && (addr < (uint)p->stack || addr + 4 >= USERTOP))
     return -1;
+  if(prefault(addr, 4) < 0)
+    return -1;
   *ip = *(int*)(addr);
   return 0;
 }
@@ -42,9 +44,12 @@ fetchstr(struct proc *p, uint addr, char **pp)
     ep = (char*)p->sz;
   if(addr >= (uint)p->stack && addr < USERTOP)
       ep = (char*)USERTOP;
-  for(s = *pp; s < ep; s++)
+  for(s = *pp; s < ep; s++){
+    if((s == *pp || (uint)s % PGSIZE == 0) && prefault((uint)s, 1) < 0)
+      return -1;
     if(*s == 0)
       return s - *pp;
+  }
   return -1;
 }
 
@@ -67,6 +72,8 @@ argptr(int n, char **pp, int size)
     return -1;
   if(((uint)i >= proc->sz && (uint)i < (uint)proc->stack)|| ((uint)i+size > proc->sz && (uint)i + size < (uint)proc->stack)|| i == 0)
     return -1;
+  if(prefault(i, size) < 0)
+    return -1;
   *pp = (char*)i;
   return 0;
 }
@@ -114,6 +121,23 @@ static int (*syscalls[])(void) = {
 [SYS_uptime]  sys_uptime,
 [SYS_getnextpid] sys_getnextpid,
 [SYS_getprocstate] sys_getprocstate,
+[SYS_clone]   sys_clone,
+[SYS_join]    sys_join,
+[SYS_futex_wait] sys_futex_wait,
+[SYS_futex_wake] sys_futex_wake,
+[SYS_userfault] sys_userfault,
+[SYS_userfault_copy] sys_userfault_copy,
+[SYS_setrlimit] sys_setrlimit,
+[SYS_getrlimit] sys_getrlimit,
+[SYS_memstat] sys_memstat,
+[SYS_ksmctl]  sys_ksmctl,
+[SYS_hugeheap] sys_hugeheap,
+[SYS_nice]    sys_nice,
+[SYS_schedstat] sys_schedstat,
+[SYS_setweight] sys_setweight,
+[SYS_nanosleep] sys_nanosleep,
+[SYS_clock_gettime] sys_clock_gettime,
+[SYS_pagectl] sys_pagectl,
 };
 
 // Called on a syscall trap. Checks that the syscall number (passed via eax)
@@ -390,3 +390,39 @@ sys_pipe(void)
   fd[1] = fd1;
   return 0;
 }
+
+// Register [addr, addr+len) for user-space fault handling and
+// return a descriptor that reports faults there.
+int
+sys_userfault(void)
+{
+  int addr, len, fd;
+  struct file *f;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0)
+    return -1;
+  if(userfaultalloc(&f, addr, addr + len) < 0)
+    return -1;
+  if((fd = fdalloc(f)) < 0){
+    fileclose(f);
+    return -1;
+  }
+  return fd;
+}
+
+// Resolve faults at dst in the address space registered with fd
+// by installing a len-byte page copied from src.
+int
+sys_userfault_copy(void)
+{
+  struct file *f;
+  int dst, len;
+  char *src;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &dst) < 0 || argint(3, &len) < 0 ||
+     argptr(2, &src, len) < 0)
+    return -1;
+  if(f->type != FD_USERFAULT)
+    return -1;
+  return userfaultcopy(f->uf, dst, src, len);
+}
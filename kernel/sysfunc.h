@@ -25,5 +25,22 @@ int sys_write(void);
 int sys_uptime(void);
 int sys_getnextpid(void);
 int sys_getprocstate(void);
+int sys_clone(void);
+int sys_join(void);
+int sys_futex_wait(void);
+int sys_futex_wake(void);
+int sys_userfault(void);
+int sys_userfault_copy(void);
+int sys_setrlimit(void);
+int sys_getrlimit(void);
+int sys_memstat(void);
+int sys_ksmctl(void);
+int sys_hugeheap(void);
+int sys_nice(void);
+int sys_schedstat(void);
+int sys_setweight(void);
+int sys_nanosleep(void);
+int sys_clock_gettime(void);
+int sys_pagectl(void);
 
 #endif // _SYSFUNC_H_
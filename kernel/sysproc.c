@@ -5,6 +5,10 @@
 #include "mmu.h"
 #include "proc.h"
 #include "sysfunc.h"
+#include "rlimit.h"
+#include "memstat.h"
+#include "schedstat.h"
+#include "time.h"
 
 int
 sys_fork(void)
@@ -71,12 +75,39 @@ sys_sleep(void)
       release(&tickslock);
       return -1;
     }
-    sleep(&ticks, &tickslock);
+    // Nothing wakes &ticks0; the timer ends the sleep, once.
+    proc->swappable = 1;
+    sleeptimeout(&ticks0, &tickslock, n - (ticks - ticks0));
+    proc->swappable = 0;
   }
   release(&tickslock);
   return 0;
 }
 
+int
+sys_nanosleep(void)
+{
+  struct timespec *ts;
+
+  if(argptr(0, (void*)&ts, sizeof(*ts)) < 0 || ts->tv_nsec >= 1000000000)
+    return -1;
+  return nanosleep(ts->tv_sec, ts->tv_nsec);
+}
+
+int
+sys_clock_gettime(void)
+{
+  struct timespec *ts, t;
+  int clk;
+
+  if(argint(0, &clk) < 0 || argptr(1, (void*)&ts, sizeof(*ts)) < 0)
+    return -1;
+  if(clockgettime(clk, &t) < 0)
+    return -1;
+  *ts = t;
+  return 0;
+}
+
 // return how many clock tick interrupts have occurred
 // since boot.
 int
@@ -118,3 +149,146 @@ sys_getprocstate(void) {
     
     return getprocstate(pid, state, n);
 }
+
+int
+sys_clone(void)
+{
+  int fn, arg, stack;
+
+  if(argint(0, &fn) < 0 || argint(1, &arg) < 0 || argint(2, &stack) < 0)
+    return -1;
+  return clone((void(*)(void*))fn, (void*)arg, (void*)stack);
+}
+
+int
+sys_join(void)
+{
+  void **stack;
+
+  if(argptr(0, (void*)&stack, sizeof(*stack)) < 0)
+    return -1;
+  return join(stack);
+}
+
+int
+sys_futex_wait(void)
+{
+  int addr, val, timeout;
+
+  if(argint(0, &addr) < 0 || argint(1, &val) < 0 || argint(2, &timeout) < 0)
+    return -1;
+  return futexwait(addr, val, timeout);
+}
+
+int
+sys_futex_wake(void)
+{
+  int addr, n;
+
+  if(argint(0, &addr) < 0 || argint(1, &n) < 0)
+    return -1;
+  return futexwake(addr, n);
+}
+
+int
+sys_setrlimit(void)
+{
+  int resource, limit;
+
+  if(argint(0, &resource) < 0 || argint(1, &limit) < 0)
+    return -1;
+  return vmsetlimit(proc->pgdir, resource, limit);
+}
+
+int
+sys_getrlimit(void)
+{
+  int resource;
+  struct rlimit *rl, r;
+
+  if(argint(0, &resource) < 0 || argptr(1, (void*)&rl, sizeof(*rl)) < 0)
+    return -1;
+  if(vmgetlimit(proc->pgdir, resource, &r) < 0)
+    return -1;
+  *rl = r;
+  return 0;
+}
+
+int
+sys_memstat(void)
+{
+  struct memstat *ms, m;
+
+  if(argptr(0, (void*)&ms, sizeof(*ms)) < 0)
+    return -1;
+  memstat(&m);
+  *ms = m;
+  return 0;
+}
+
+int
+sys_ksmctl(void)
+{
+  int npages, nticks;
+
+  if(argint(0, &npages) < 0 || argint(1, &nticks) < 0)
+    return -1;
+  return ksmctl(npages, nticks);
+}
+
+int
+sys_pagectl(void)
+{
+  int addr, op;
+
+  if(argint(0, &addr) < 0 || argint(1, &op) < 0)
+    return -1;
+  return pagectl(addr, op);
+}
+
+// From threshold bytes on, sbrk() grows the heap up to a huge page
+// boundary (see growproc()); a negative threshold turns this off.
+// Returns the previous threshold.
+int
+sys_hugeheap(void)
+{
+  int threshold, old;
+
+  if(argint(0, &threshold) < 0)
+    return -1;
+  old = proc->hugeheap;
+  proc->hugeheap = threshold < 0 ? -1 : threshold;
+  return old;
+}
+
+int
+sys_nice(void)
+{
+  int inc;
+
+  if(argint(0, &inc) < 0)
+    return -1;
+  return nice(inc);
+}
+
+int
+sys_setweight(void)
+{
+  int weight;
+
+  if(argint(0, &weight) < 0)
+    return -1;
+  return setweight(weight);
+}
+
+int
+sys_schedstat(void)
+{
+  struct schedstat *ss, s;
+
+  if(argptr(0, (void*)&ss, sizeof(*ss)) < 0)
+    return -1;
+  schedstat(&s);
+  *ss = s;
+  return 0;
+}
@@ -1,13 +1,20 @@
 // Intel 8253/8254/82C54 Programmable Interval Timer (PIT).
-// Only used on uniprocessors;
-// SMP machines use the local APIC timer.
+// Only interrupts on uniprocessors; SMP machines use the local
+// APIC timer.  Channel 2 times the TSC and the local APIC timer at
+// boot.
 
 #include "types.h"
 #include "defs.h"
+#include "param.h"
 #include "traps.h"
 #include "x86.h"
 
 #define IO_TIMER1       0x040           // 8253 Timer #1
+#define IO_TIMER2       (IO_TIMER1 + 2) // counter 2
+#define IO_PPI          0x061           // counter 2 gate and output
+#define PPI_GATE2       0x01            // let counter 2 count
+#define PPI_SPEAKER     0x02            // connect it to the speaker
+#define PPI_OUT2        0x20            // counter 2 output
 
 // Frequency of all three count-down timers;
 // (TIMER_FREQ/freq) is the appropriate count
@@ -19,14 +26,48 @@
 #define TIMER_MODE      (IO_TIMER1 + 3) // timer mode port
 #define TIMER_SEL0      0x00    // select counter 0
 #define TIMER_RATEGEN   0x04    // mode 2, rate generator
+#define TIMER_SEL2      0x80    // select counter 2
+#define TIMER_INTTC     0x00    // mode 0, interrupt on terminal count
 #define TIMER_16BIT     0x30    // r/w counter 16 bits, LSB first
 
+#define CALHZ           100     // calibrate over 1/CALHZ second
+
+uint tsckhz;                    // TSC counts per millisecond
+uint64 tscboot;                 // TSC when it was calibrated
+
+// Measure the TSC and, if there is one, the local APIC timer while
+// counter 2 counts down 1/CALHZ second in mode 0, its output going
+// high at the end.  The gate starts it; the speaker stays off.
+void
+timercalibrate(void)
+{
+  uint64 t0;
+
+  outb(IO_PPI, inb(IO_PPI) & ~(PPI_GATE2 | PPI_SPEAKER));
+  outb(TIMER_MODE, TIMER_SEL2 | TIMER_INTTC | TIMER_16BIT);
+  outb(IO_TIMER2, TIMER_DIV(CALHZ) % 256);
+  outb(IO_TIMER2, TIMER_DIV(CALHZ) / 256);
+  lapiconeshot(0xFFFFFFFF);
+  outb(IO_PPI, inb(IO_PPI) | PPI_GATE2);
+  t0 = rdtsc();
+  while((inb(IO_PPI) & PPI_OUT2) == 0)
+    ;
+  tscboot = rdtsc();
+  if(lapic)
+    lapicfreq = (0xFFFFFFFF - lapiccount()) * CALHZ;
+  lapiconeshot(0);
+  outb(IO_PPI, inb(IO_PPI) & ~PPI_GATE2);
+  tsckhz = (uint)(tscboot - t0) / (1000/CALHZ);
+}
+
 void
 timerinit(void)
 {
-  // Interrupt 100 times/sec.
+  if(tsckhz == 0)
+    timercalibrate();
+  // Interrupt HZ times/sec.
   outb(TIMER_MODE, TIMER_SEL0 | TIMER_RATEGEN | TIMER_16BIT);
-  outb(IO_TIMER1, TIMER_DIV(100) % 256);
-  outb(IO_TIMER1, TIMER_DIV(100) / 256);
+  outb(IO_TIMER1, TIMER_DIV(HZ) % 256);
+  outb(IO_TIMER1, TIMER_DIV(HZ) / 256);
   picenable(IRQ_TIMER);
 }
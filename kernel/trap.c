@@ -7,9 +7,17 @@
 #include "traps.h"
 #include "spinlock.h"
 
+// Model-specific registers for sysenter.
+#define MSR_SYSENTER_CS   0x174
+#define MSR_SYSENTER_ESP  0x175
+#define MSR_SYSENTER_EIP  0x176
+
+#define CPUID_SEP   (1<<11)  // sysenter and sysexit
+
 // Interrupt descriptor table (shared by all CPUs).
 struct gatedesc idt[256];
 extern uint vectors[];  // in vectors.S: array of 256 entry pointers
+extern char sysentry[]; // in trapasm.S: sysenter entry point
 struct spinlock tickslock;
 uint ticks;
 
@@ -31,9 +39,29 @@ idtinit(void)
   lidt(idt, sizeof(idt));
 }
 
+// Let user programs make system calls with sysenter as well as
+// int $T_SYSCALL, if this CPU has it.  sysenter switches to
+// SEG_KCODE and to a stack pointer at this CPU's task state, from
+// which sysentry (trapasm.S) loads the running process's kernel
+// stack, esp0.  Run once at boot time on each CPU.
+void
+sysenterinit(void)
+{
+  uint a, b, c, d;
+
+  cpuid(1, &a, &b, &c, &d);
+  if(!(d & CPUID_SEP))
+    return;
+  wrmsr(MSR_SYSENTER_CS, SEG_KCODE<<3);
+  wrmsr(MSR_SYSENTER_ESP, (uint)&cpu->ts);
+  wrmsr(MSR_SYSENTER_EIP, (uint)sysentry);
+}
+
 void
 trap(struct trapframe *tf)
 {
+  int ntick;
+
   if(tf->trapno == T_SYSCALL){
     if(proc->killed)
       exit();
@@ -44,14 +72,14 @@ trap(struct trapframe *tf)
     return;
   }
 
+  ntick = 0;
   switch(tf->trapno){
   case T_IRQ0 + IRQ_TIMER:
-    if(cpu->id == 0){
-      acquire(&tickslock);
-      ticks++;
-      wakeup(&ticks);
-      release(&tickslock);
-    }
+    ntick = clockintr();
+    lapiceoi();
+    break;
+  case T_IRQ0 + IRQ_RESCHED:
+    // Only wakes an idle CPU out of hlt; see idle() in proc.c.
     lapiceoi();
     break;
   case T_IRQ0 + IRQ_IDE:
@@ -69,6 +97,13 @@ trap(struct trapframe *tf)
     uartintr();
     lapiceoi();
     break;
+  case T_DEVICE:
+    // The process's first FPU or SSE instruction since it got the
+    // CPU.  The kernel itself only uses the FPU with CR0.TS clear.
+    if(proc == 0 || (tf->cs&3) != DPL_USER)
+      goto bad;
+    fputrap();
+    break;
   case T_IRQ0 + 7:
   case T_IRQ0 + IRQ_SPURIOUS:
     cprintf("cpu%d: spurious interrupt at %x:%x\n",
@@ -77,21 +112,17 @@ trap(struct trapframe *tf)
     break;
   
   case 14: // If page fault
-    uint addr = tf->esp;
-    uint new_stack = (uint)proc->stack - 0x1000;
-    if(addr >= new_stack 
-            && proc->sz + 0x5000 <= new_stack
-            && addr < USERTOP) {
-        // if on the next page, allocate more stack
-        if(allocuvm(proc->pgdir, new_stack, new_stack + PGSIZE) == 0) {
-            //cant allocate a new page so go to default
-            goto bad;
-        }
-    } else {
-        goto bad;
-    }
-    proc->stack = (char*)new_stack;
-    break;
+    // Missing user pages may be supplied on demand, also when the
+    // kernel touches them for the process -- but only while no
+    // spinlock is held, since resolving a fault can sleep.
+    if(proc && rcr2() < USERTOP &&
+       ((tf->cs&3) == DPL_USER || cpu->ncli == 0) &&
+       pagefault(rcr2(), tf->err) == 0)
+      break;
+    // A user stack that has run onto the page below it grows.
+    if(proc && (tf->cs&3) == DPL_USER && growstack(tf->esp, rcr2()) == 0)
+      break;
+    goto bad;
 
 
 
@@ -117,10 +148,19 @@ trap(struct trapframe *tf)
   if(proc && proc->killed && (tf->cs&3) == DPL_USER)
     exit();
 
-  // Force process to give up CPU on clock tick.
+  // Force process to give up CPU on clock tick once its time slice
+  // is used up (see schedtick()).
   // If interrupts were on while locks held, would need to check nlock.
-  if(proc && proc->state == RUNNING && tf->trapno == T_IRQ0+IRQ_TIMER)
-    yield();
+  // A process preempted in user space may have its pages swapped
+  // out while it waits to run again.
+  if(proc && proc->state == RUNNING && ntick > 0 && schedtick()){
+    if((tf->cs&3) == DPL_USER){
+      proc->swappable = 1;
+      yield();
+      proc->swappable = 0;
+    } else
+      yield();
+  }
 
   // Check if the process has been killed since we yielded
   if(proc && proc->killed && (tf->cs&3) == DPL_USER)
@@ -0,0 +1,242 @@
+// User-space page fault handling.
+//
+// A process registers a page-aligned range of its heap with
+// userfault(); the kernel drops the pages in the range and returns
+// a file descriptor.  When a thread of the process later touches a
+// missing page there, it sleeps and a struct uffdmsg describing the
+// fault becomes readable from the descriptor.  A handler (another
+// thread, or a process that inherited the descriptor) supplies the
+// contents with userfault_copy(), which installs a 4 KB or 4 MB page
+// and lets the faulting threads retry.  Closing the last reference
+// to the descriptor ends the registration; threads still faulting
+// in the range are then killed.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "fs.h"
+#include "file.h"
+#include "userfault.h"
+
+#define NUSERFAULT 16  // registrations in the whole system
+#define NUFFDMSG   16  // unread fault messages per registration
+
+struct userfault {
+  struct spinlock lock;
+  pde_t *pgdir;                // registered address space, 0 if slot free
+  uint start;                  // registered range [start, end)
+  uint end;
+  int closed;                  // descriptor has been closed
+  struct uffdmsg msg[NUFFDMSG];
+  uint nread;                  // number of messages read
+  uint nwrite;                 // number of messages queued
+};
+
+// uftable.lock guards slot allocation.  Handlers change registered
+// page tables under vmlock() of the address space, taken first.
+static struct {
+  struct spinlock lock;
+  struct userfault uf[NUSERFAULT];
+} uftable;
+
+void
+userfaultinit(void)
+{
+  int i;
+
+  initlock(&uftable.lock, "uftable");
+  for(i = 0; i < NUSERFAULT; i++)
+    initlock(&uftable.uf[i].lock, "userfault");
+}
+
+// Register [start, end) of the current process for user-space
+// fault handling and return a new file for it in *pf.
+int
+userfaultalloc(struct file **pf, uint start, uint end)
+{
+  struct userfault *uf, *u;
+  struct file *f;
+
+  if(start % PGSIZE || end % PGSIZE || start < PGSIZE || start >= end ||
+     end > proc->sz)
+    return -1;
+
+  vmlock(proc->pgdir);
+  acquire(&uftable.lock);
+  uf = 0;
+  for(u = uftable.uf; u < &uftable.uf[NUSERFAULT]; u++){
+    if(u->pgdir == 0){
+      if(uf == 0)
+        uf = u;
+    } else if(u->pgdir == proc->pgdir && start < u->end && u->start < end){
+      release(&uftable.lock);
+      vmunlock(proc->pgdir);
+      return -1;
+    }
+  }
+  if(uf == 0 || (f = filealloc()) == 0){
+    release(&uftable.lock);
+    vmunlock(proc->pgdir);
+    return -1;
+  }
+  if(uvmunmap(proc->pgdir, start, end) < 0){
+    release(&uftable.lock);
+    vmunlock(proc->pgdir);
+    fileclose(f);
+    return -1;
+  }
+  // The registration keeps the address space alive until the
+  // descriptor is closed, even if the process exits first.
+  vmshare(proc->pgdir);
+  uf->pgdir = proc->pgdir;
+  uf->start = start;
+  uf->end = end;
+  uf->closed = 0;
+  uf->nread = uf->nwrite = 0;
+  release(&uftable.lock);
+  vmunlock(proc->pgdir);
+  switchuvm(proc);
+
+  f->type = FD_USERFAULT;
+  f->readable = 1;
+  f->writable = 0;
+  f->uf = uf;
+  *pf = f;
+  return 0;
+}
+
+void
+userfaultclose(struct userfault *uf)
+{
+  pde_t *pgdir;
+
+  // Faulting threads wake, fault again and find no registration.
+  acquire(&uf->lock);
+  uf->closed = 1;
+  wakeup(uf);
+  release(&uf->lock);
+
+  acquire(&uftable.lock);
+  pgdir = uf->pgdir;
+  uf->pgdir = 0;
+  release(&uftable.lock);
+  freevm(pgdir);
+}
+
+// Read whole fault messages into addr.  Blocks until at least one
+// fault is pending.  Like piperead(), copies out only after
+// releasing uf->lock.
+int
+userfaultread(struct userfault *uf, char *addr, int n)
+{
+  int i;
+  struct uffdmsg buf[NUFFDMSG];
+
+  acquire(&uf->lock);
+  while(uf->nread == uf->nwrite){
+    if(proc->killed){
+      release(&uf->lock);
+      return -1;
+    }
+    sleep(&uf->nread, &uf->lock);
+  }
+  for(i = 0; i + sizeof(struct uffdmsg) <= n && uf->nread != uf->nwrite;
+      i += sizeof(struct uffdmsg))
+    buf[i / sizeof(struct uffdmsg)] = uf->msg[uf->nread++ % NUFFDMSG];
+  // Threads that found the queue full can post their faults now.
+  wakeup(uf);
+  release(&uf->lock);
+  if(prefault((uint)addr, i) < 0 || copyout(proc->pgdir, (uint)addr, buf, i) < 0)
+    return -1;
+  return i;
+}
+
+// Resolve faults on [dst, dst+len) by installing a page holding a
+// copy of the len bytes at src in the current process.  len must
+// be PGSIZE or MAXPGSIZE, and dst aligned to it.
+int
+userfaultcopy(struct userfault *uf, uint dst, char *src, uint len)
+{
+  pde_t *pgdir;
+  char *mem;
+  int r;
+
+  if((len != PGSIZE && len != MAXPGSIZE) || dst % len != 0 ||
+     uf->closed || dst < uf->start || dst + len > uf->end)
+    return -1;
+  if((mem = buddy_alloc(len)) == 0)
+    return -1;
+  memmove(mem, src, len);
+
+  // The registration holds pgdir until the descriptor is closed.
+  pgdir = uf->pgdir;
+  vmlock(pgdir);
+  acquire(&uftable.lock);
+  if((r = uvmmap(pgdir, dst, mem, len)) < 0)
+    kfree(mem);
+  release(&uftable.lock);
+  vmunlock(pgdir);
+
+  acquire(&uf->lock);
+  wakeup(uf);
+  release(&uf->lock);
+  return r;
+}
+
+// Post a message for a fault at va unless one is already pending.
+// Returns 0 if the queue is full.  Caller holds uf->lock.
+static int
+userfaultpost(struct userfault *uf, uint va, int write)
+{
+  struct uffdmsg *m;
+  uint i;
+
+  for(i = uf->nread; i != uf->nwrite; i++)
+    if(uf->msg[i % NUFFDMSG].addr == va)
+      return 1;
+  if(uf->nwrite == uf->nread + NUFFDMSG)
+    return 0;
+  m = &uf->msg[uf->nwrite++ % NUFFDMSG];
+  m->addr = va;
+  m->flags = write ? UFFD_WRITE : 0;
+  m->pid = proc->pid;
+  wakeup(&uf->nread);
+  return 1;
+}
+
+// Called on a fault at page va of the current process.  If va is
+// registered, report the fault and sleep until a handler resolves
+// it.  Returns 0 if the access should be retried, -1 if va is not
+// registered.
+int
+userfaulthandle(uint va, int write)
+{
+  struct userfault *uf;
+  pde_t *pgdir;
+  int posted;
+
+  pgdir = proc->pgdir;
+  acquire(&uftable.lock);
+  for(uf = uftable.uf; uf < &uftable.uf[NUSERFAULT]; uf++)
+    if(uf->pgdir == pgdir && va >= uf->start && va < uf->end)
+      break;
+  if(uf == &uftable.uf[NUSERFAULT]){
+    release(&uftable.lock);
+    return -1;
+  }
+  acquire(&uf->lock);
+  release(&uftable.lock);
+
+  posted = 0;
+  while(uva2pa(pgdir, va) == 0 && !uf->closed && uf->pgdir == pgdir &&
+        !proc->killed){
+    if(!posted)
+      posted = userfaultpost(uf, va, write);
+    sleep(uf, &uf->lock);
+  }
+  release(&uf->lock);
+  return 0;
+}
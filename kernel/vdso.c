@@ -0,0 +1,35 @@
+// The vDSO page (include/vdso.h).
+//
+// vdsoinit() maps one page at VDSO, read-only for user programs, in
+// the kernel part of the address space, whose page tables every
+// address space shares; so all processes see it from exec on, and
+// fork, swapping and teardown, which deal only with memory below
+// USERTOP, leave it alone.  clock.c keeps ticks and the clock's
+// calibration in it, and scheduler() the pid of each CPU's process.
+//
+// Each CPU's GDT has a read-only user segment, SEG_UCPU, over that
+// CPU's entry (seginit()).  exec() and userinit() load it into the
+// process's %fs, and trapret reloads %fs from the GDT of the CPU the
+// process goes back to user mode on, so one load through %fs reads
+// the entry of the CPU the reader is running on.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "vdso.h"
+
+struct vdso *vdso;
+
+void
+vdsoinit(void)
+{
+  int i;
+
+  if((vdso = (struct vdso*)kalloc()) == 0)
+    panic("vdsoinit");
+  memset(vdso, 0, PGSIZE);
+  for(i = 0; i < NCPU; i++)
+    vdso->cpu[i].cpu = i;
+  kvmmapuser(VDSO, (char*)vdso);
+}
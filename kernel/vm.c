@@ -5,17 +5,152 @@
 #include "mmu.h"
 #include "proc.h"
 #include "elf.h"
+#include "spinlock.h"
+#include "rlimit.h"
+#include "memstat.h"
+#include "pagectl.h"
+#include "vdso.h"
 
 extern char data[];  // defined in data.S
 
 static pde_t *kpgdir;  // for use in scheduler()
 
+// Every user page directory has an entry here, made by setupuvm().
+// It counts the references to the page directory -- threads sharing
+// it (see clone() in proc.c) and others keeping it alive -- and the
+// memory charged against its limits (see include/rlimit.h).
+// Exec and userfault registrations can keep page directories alive
+// beyond one per process, hence the slack.
+#define NVMSPACE (NPROC + NPROC/2)
+
+// The user part of an address space is mapped only inside its
+// regions: page-aligned, sorted, disjoint ranges of user addresses
+// (text and data, heap, stack, userfault copies).  Teardown and fork
+// walk just these.  When there are too many, neighbours are joined,
+// so a region may also cover unmapped pages.
+#define NREGION 8
+
+// How many ticks uvmalloc() waits for something to become swappable.
+#define SWAPWAIT 100
+
+#if USERTOP % MAXPGSIZE
+#error "USERTOP is not a multiple of the huge page size"
+#endif
+
+#if defined(PAE) && KERNBASE
+#error "PAE needs KERNBASE 0; the boot page table is not PAE"
+#endif
+
+#ifdef PAE
+#define cmpxchgpte cmpxchg64
+// User memory is all in the first page directory (see allocpgdir()).
+#if USERTOP > 0x40000000
+#error "USERTOP is beyond the first page directory"
+#endif
+#else
+#define cmpxchgpte cmpxchg
+#endif
+
+struct region {
+  uint start;
+  uint end;
+};
+
+struct vmspace {
+  pde_t *pgdir;                // 0 if the entry is free
+  int ref;
+  int busy;                    // held by vmlock()
+  uint use[2];                 // pages and huge pages charged
+  uint limit[2];               // RLIMIT_PAGES, RLIMIT_HUGEPAGES
+  struct mgroup *group;        // innermost tree limit, or 0
+  int nregion;
+  struct region region[NREGION];
+};
+
+// A tree limit.  Charges to a space go to every group around it.
+struct mgroup {
+  int ref;                     // spaces and groups inside; 0 if free
+  struct vmspace *leader;      // space that set the limit, 0 once gone
+  struct mgroup *parent;
+  uint use[2];
+  uint limit[2];               // RLIMIT_TREEPAGES, RLIMIT_TREEHUGEPAGES
+};
+
+static struct {
+  struct spinlock lock;
+  struct vmspace space[NVMSPACE];
+  struct mgroup group[NVMSPACE];
+} pgdirs;
+
+// A page swapped out to slot n is recorded in its PTE, or for a
+// huge page in its PDE, as n<<PTXSHIFT | PTE_SWP with PTE_P clear.
+// The PTE_W, PTE_U and PTE_PS bits are kept.
+#define SWAPENTRY(n, e) (((n) << PTXSHIFT) | ((e) & (PTE_W|PTE_U|PTE_PS)) | PTE_SWP)
+#define SWAPSLOT(e)     ((uint)(e) >> PTXSHIFT)
+#define ISSWAPPED(e)    (((e) & (PTE_P|PTE_SWP)) == PTE_SWP)
+
+// Heap pages reserved by zerouvm() are zero-filled on demand (see
+// zerofault()).  Until touched, such a page has the PTE ZEROENTRY,
+// or for a whole 4M region the PDE ZEROENTRY|PTE_PS.  Read, it maps
+// zeropage, or zerohuge, read-only; once written, a private page.
+// The pages are charged to the address space all along.
+#define ZEROENTRY       (PTE_ZERO|PTE_W|PTE_U)
+#define ISZEROFILL(e)   (((e) & (PTE_P|PTE_ZERO)) == PTE_ZERO)
+
+static char *zeropage;
+static char *zerohuge;
+
+static struct {
+  struct spinlock lock;
+  uint zeropages;              // pages mapped to zeropage or zerohuge
+} stats;
+
+// Clock hand for swapout(): a process table slot and a user address
+// in its address space.
+static struct {
+  int slot;
+  uint va;
+} hand;
+
 // Allocate one page table for the machine for the kernel address
 // space for scheduler processes.
 void
 kvmalloc(void)
 {
+  initlock(&pgdirs.lock, "pgdirs");
+  initlock(&stats.lock, "vmstats");
   kpgdir = setupkvm();
+  if((zeropage = kalloc()) == 0 || (zerohuge = buddy_alloc(MAXPGSIZE)) == 0)
+    panic("kvmalloc: zero pages");
+  memset(zeropage, 0, PGSIZE);
+  memset(zerohuge, 0, MAXPGSIZE);
+}
+
+// Does entry e map zeropage, or a part of zerohuge?
+static int
+zeromapped(pte_t e)
+{
+  uint pa;
+
+  pa = PTE_ADDR(e);
+  return (e & PTE_P) && (pa == PADDR(zeropage) || pa - PADDR(zerohuge) < MAXPGSIZE);
+}
+
+static void
+zerocount(int n)
+{
+  acquire(&stats.lock);
+  stats.zeropages += n;
+  release(&stats.lock);
+}
+
+void
+memstat(struct memstat *m)
+{
+  acquire(&stats.lock);
+  m->zeropages = stats.zeropages;
+  release(&stats.lock);
+  ksmstat(m);
 }
 
 // Set up CPU's kernel segment descriptors.
@@ -38,6 +173,10 @@ seginit(void)
   // Map cpu, and curproc
   c->gdt[SEG_KCPU] = SEG(STA_W, &c->cpu, 8, 0);
 
+  // This CPU's entry in the vDSO page, read-only, for user %fs.
+  c->gdt[SEG_UCPU] = SEG(0, VDSO + (uint)&((struct vdso*)0)->cpu[c - cpus],
+                         sizeof(struct vdsocpu), DPL_USER);
+
   lgdt(c->gdt, sizeof(c->gdt));
   loadgs(SEG_KCPU << 3);
   
@@ -57,7 +196,7 @@ walkpgdir(pde_t *pgdir, const void *va, int create)
 
   pde = &pgdir[PDX(va)];
   if(*pde & PTE_P){
-    pgtab = (pte_t*)PTE_ADDR(*pde);
+    pgtab = (pte_t*)KADDR(PTE_ADDR(*pde));
   } else {
     if(!create || (pgtab = (pte_t*)kalloc()) == 0)
       return 0;
@@ -71,6 +210,70 @@ walkpgdir(pde_t *pgdir, const void *va, int create)
   return &pgtab[PTX(va)];
 }
 
+// Map the kernel page mem at va, at or above USERTOP, read-only
+// for user programs as well.  Since every page directory shares the
+// kernel's page tables (see setupkvm()), this must happen before the
+// first user address space is set up; mem is not user memory, and
+// is left out of the reverse map and the limits.
+void
+kvmmapuser(uint va, char *mem)
+{
+  pte_t *pte;
+
+  if(va < USERTOP || (pte = walkpgdir(kpgdir, (void*)va, 1)) == 0)
+    panic("kvmmapuser");
+  *pte = PADDR(mem) | PTE_P | PTE_U;
+}
+
+// Does entry e map a frame of user memory that the reverse map
+// (rmap.c) records?  The zero pages are left out.
+static int
+tracked(pte_t e)
+{
+  return (e & (PTE_P|PTE_U)) == (PTE_P|PTE_U) && !zeromapped(e);
+}
+
+// Change *pte, the entry for user address va in pgdir (the PDE of a
+// huge page), from old to new, and the reverse map with it.
+// Returns 1 if done, 0 if *pte is no longer old, or -1 if the
+// reverse map has no room for another mapping of new's frame.
+int
+setpte(pde_t *pgdir, uint va, pte_t *pte, pte_t old, pte_t new)
+{
+  int moved, r;
+
+  moved = PTE_ADDR(old) != PTE_ADDR(new) || !tracked(old) || !tracked(new);
+  rmaplock();
+  r = 1;
+  if(moved && tracked(new) && rmapadd(PTE_ADDR(new), pgdir, va) < 0)
+    r = -1;
+  else if(cmpxchgpte(pte, old, new) != old){
+    if(moved && tracked(new))
+      rmapdel(PTE_ADDR(new), pgdir, va);
+    r = 0;
+  } else if(moved && tracked(old))
+    rmapdel(PTE_ADDR(old), pgdir, va);
+  rmapunlock();
+  return r;
+}
+
+// Set *pte, the entry for va in pgdir, to new, which maps nothing
+// or a frame with no other mappings, whatever the hardware does to
+// the accessed and dirty bits meanwhile.  Returns the old entry.
+static pte_t
+putpte(pde_t *pgdir, uint va, pte_t *pte, pte_t new)
+{
+  pte_t old;
+  int r;
+
+  do {
+    old = *pte;
+  } while((r = setpte(pgdir, va, pte, old, new)) == 0);
+  if(r < 0)
+    panic("putpte");
+  return old;
+}
+
 // Create PTEs for linear addresses starting at la that refer to
 // physical addresses starting at pa. la and size might not
 // be page-aligned.
@@ -91,7 +294,10 @@ mappages(pde_t *pgdir, void *la, uint size, uint pa, int perm)
                 return -1;
             if(*pte & PTE_P)
                 panic("remap");
-            *pte = pa | perm | PTE_P;
+            if(perm & PTE_U)
+                putpte(pgdir, (uint)a, pte, pa | perm | PTE_P);
+            else
+                *pte = pa | perm | PTE_P;
             if(a == last)
                 break;
             a += PGSIZE;
@@ -108,7 +314,10 @@ mappages(pde_t *pgdir, void *la, uint size, uint pa, int perm)
             //if the page directory is already present, panic, remap
             if(*pde & PTE_P)
                 panic("remap");
-            *pde = pa | perm | PTE_P | PTE_PS;
+            if(perm & PTE_U)
+                putpte(pgdir, (uint)a, pde, pa | perm | PTE_P | PTE_PS);
+            else
+                *pde = pa | perm | PTE_P | PTE_PS;
             if(a == last)
                 break;
             a+= MAXPGSIZE;
@@ -131,71 +340,451 @@ mappages(pde_t *pgdir, void *la, uint size, uint pa, int perm)
 // than its memory.
 // 
 // setupkvm() and exec() set up every page table like this:
-//   0..640K          : user memory (text, data, stack, heap)
-//   640K..1M         : mapped direct (for IO space)
-//   1M..end          : mapped direct (for the kernel's text and data)
-//   end..PHYSTOP     : mapped direct (kernel heap and user pages)
+//   0..USERTOP       : user memory (text, data, stack, heap)
+//   USERTOP..KERNLINK: physical memory below the kernel (IO space);
+//                      with KERNBASE 0, just the 640K-1M I/O hole
+//   KERNLINK..data   : the kernel's text and read-only data
+//   data..KADDR(physend): kernel data, heap and user pages
 //   0xfe000000..0    : mapped direct (devices such as ioapic)
 //
+// The kernel sees physical address pa at KADDR(pa), KERNBASE+pa (see
+// include/param.h).  By default KERNBASE is 0: the kernel is mapped
+// direct, above USERTOP, and the memory below it goes unused.  With
+// make KERNBASE=0x40000000 (or 0x80000000) user programs get the
+// addresses below KERNBASE and the kernel all of physical memory.
 // The kernel allocates memory for its heap and for user memory
-// between kernend and the end of physical memory (PHYSTOP).
+// between kernend and the end of physical memory (physend, at most
+// PHYSTOP).
 // The virtual address space of each user program includes the kernel
-// (which is inaccessible in user mode).  The user program addresses
-// range from 0 till 640KB (USERTOP), which where the I/O hole starts
-// (both in physical memory and in the kernel's virtual address
-// space).
+// (which is inaccessible in user mode).
 static struct kmap {
-  void *p;
-  void *e;
+  void *virt;
+  uint pstart;
+  uint pend;
   int perm;
 } kmap[] = {
-  {(void*)USERTOP,    (void*)0x1080000, PTE_W},  // I/O space
-  {(void*)0x1080000,   data,            0    },  // kernel text, rodata
-  {data,              (void*)PHYSTOP,  PTE_W},  // kernel data, memory
-  {(void*)0xFE000000, 0,               PTE_W},  // device mappings
+#if KERNBASE
+  {(void*)USERTOP,    PADDR(USERTOP),  PADDR(KERNLINK), PTE_W},  // I/O space
+#else
+  {(void*)USERTOP,    0xA0000,         0x100000,        PTE_W},  // I/O hole
+#endif
+  {(void*)KERNLINK,   PADDR(KERNLINK), PADDR(data),     0    },  // kernel text, rodata
+  {data,              PADDR(data),     PHYSTOP,         PTE_W},  // kernel data, memory
+  {(void*)0xFE000000, 0xFE000000,      0,               PTE_W},  // device mappings
 };
 
+#ifdef PAE
+// Allocate an empty page directory, with its page-directory-pointer
+// table in the page below (see CR3() in mmu.h).  kpgdir gets all four
+// page directories; the others get just the first, which covers the
+// low 1G and so all of user memory, and share kpgdir's other three.
+static pde_t*
+allocpgdir(void)
+{
+  char *mem;
+  pde_t *pdpt, *pgdir;
+  int i, n;
+
+  n = kpgdir ? 1 : NPDPTENTRIES;
+  if((mem = buddy_alloc((1 + n) * PGSIZE)) == 0)
+    return 0;
+  memset(mem, 0, (1 + n) * PGSIZE);
+  pdpt = (pde_t*)mem;
+  pgdir = (pde_t*)(mem + PGSIZE);
+  for(i = 0; i < NPDPTENTRIES; i++){
+    if(i < n)
+      pdpt[i] = PADDR((char*)pgdir + i*PGSIZE) | PTE_P;
+    else
+      pdpt[i] = PDPT(kpgdir)[i];
+  }
+  return pgdir;
+}
+#else
+static pde_t*
+allocpgdir(void)
+{
+  pde_t *pgdir;
+
+  if((pgdir = (pde_t*)kalloc()) == 0)
+    return 0;
+  memset(pgdir, 0, PGSIZE);
+  return pgdir;
+}
+#endif
+
 // Set up kernel part of a page table.
 pde_t*
 setupkvm(void)
 {
   pde_t *pgdir;
   struct kmap *k;
+  uint pend;
 
-  if((pgdir = (pde_t*)kalloc()) == 0)
+  if((pgdir = allocpgdir()) == 0)
     return 0;
-  memset(pgdir, 0, PGSIZE);
-  k = kmap;
-  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
-    if(mappages(pgdir, k->p, k->e - k->p, (uint)k->p, k->perm) < 0)
+  // The kernel part never changes after boot, so every page
+  // directory shares kpgdir's page tables.  Only the first page's
+  // worth of PDEs is copied; in PAE mode the rest is shared whole.
+  if(kpgdir){
+    memmove(&pgdir[PDX(USERTOP)], &kpgdir[PDX(USERTOP)],
+            PGSIZE - PDX(USERTOP) * sizeof(pde_t));
+    return pgdir;
+  }
+  for(k = kmap; k < &kmap[NELEM(kmap)]; k++){
+    // Memory is mapped as far as the machine has any (memmap.c).
+    pend = k->pend == PHYSTOP ? physend : k->pend;
+    if(mappages(pgdir, k->virt, pend - k->pstart, k->pstart, k->perm) < 0)
       return 0;
+  }
+
+  return pgdir;
+}
 
+// Free the page tables left in the user part of pgdir, which must
+// map nothing, and pgdir itself.  The kernel part belongs to kpgdir.
+static void
+freepgdir(pde_t *pgdir)
+{
+  uint i;
+
+  for(i = 0; i < PDX(USERTOP); i++){
+    if(pgdir[i] & PTE_P)
+      kfree((char*)KADDR(PTE_ADDR(pgdir[i])));
+  }
+#ifdef PAE
+  kfree((char*)PDPT(pgdir));
+#else
+  kfree((char*)pgdir);
+#endif
+}
+
+// Caller holds pgdirs.lock.
+static struct vmspace*
+vmspace(pde_t *pgdir)
+{
+  struct vmspace *s;
+
+  for(s = pgdirs.space; s < &pgdirs.space[NVMSPACE]; s++)
+    if(s->pgdir == pgdir)
+      return s;
+  return 0;
+}
+
+// Set up a page table for a new user address space, with no user
+// memory.  It inherits the memory limits of parent, if not 0.
+pde_t*
+setupuvm(pde_t *parent)
+{
+  pde_t *pgdir;
+  struct vmspace *s, *ps;
+
+  if((pgdir = setupkvm()) == 0)
+    return 0;
+  acquire(&pgdirs.lock);
+  if((s = vmspace(0)) == 0){
+    release(&pgdirs.lock);
+    freepgdir(pgdir);
+    return 0;
+  }
+  s->pgdir = pgdir;
+  s->ref = 1;
+  s->busy = 0;
+  s->use[0] = s->use[1] = 0;
+  s->limit[0] = s->limit[1] = RLIM_INFINITY;
+  s->group = 0;
+  s->nregion = 0;
+  if(parent && (ps = vmspace(parent)) != 0){
+    s->limit[0] = ps->limit[0];
+    s->limit[1] = ps->limit[1];
+    if((s->group = ps->group) != 0)
+      s->group->ref++;
+  }
+  release(&pgdirs.lock);
   return pgdir;
 }
 
+// Add [start, end) to the regions of s, joining the regions it
+// overlaps or touches.  If there is no room for another region, the
+// nearest one grows to take it in.  Caller holds pgdirs.lock.
+static void
+regionadd(struct vmspace *s, uint start, uint end)
+{
+  struct region *r;
+  int i, j;
+
+  if(start >= end)
+    return;
+  for(i = 0; i < s->nregion && s->region[i].end < start; i++)
+    ;
+  if((i == s->nregion || end < s->region[i].start) && s->nregion == NREGION){
+    if(i == NREGION ||
+       (i > 0 && start - s->region[i-1].end < s->region[i].start - end))
+      i--;
+  } else if(i == s->nregion || end < s->region[i].start){
+    memmove(&s->region[i+1], &s->region[i], (s->nregion - i) * sizeof(*r));
+    s->nregion++;
+    s->region[i].start = start;
+    s->region[i].end = end;
+    return;
+  }
+  r = &s->region[i];
+  if(start < r->start)
+    r->start = start;
+  if(end > r->end)
+    r->end = end;
+  for(j = i+1; j < s->nregion && s->region[j].start <= r->end; j++)
+    if(s->region[j].end > r->end)
+      r->end = s->region[j].end;
+  memmove(&s->region[i+1], &s->region[j], (s->nregion - j) * sizeof(*r));
+  s->nregion -= j - (i+1);
+}
+
+// Take [start, end) out of the regions of s.  A region that would
+// split in two with no room for another is left whole.  Caller
+// holds pgdirs.lock.
+static void
+regiondel(struct vmspace *s, uint start, uint end)
+{
+  struct region *r;
+  int i;
+
+  for(i = 0; i < s->nregion; i++){
+    r = &s->region[i];
+    if(r->end <= start || end <= r->start)
+      continue;
+    if(start > r->start && end < r->end){
+      if(s->nregion == NREGION)
+        continue;
+      memmove(r+1, r, (s->nregion - i) * sizeof(*r));
+      s->nregion++;
+      r->end = start;
+      (r+1)->start = end;
+      return;
+    }
+    if(start > r->start)
+      r->end = start;
+    else if(end < r->end)
+      r->start = end;
+    else {
+      memmove(r, r+1, (s->nregion - i - 1) * sizeof(*r));
+      s->nregion--;
+      i--;
+    }
+  }
+}
+
+// Note that [start, end) of pgdir is to be mapped.
+static void
+vmregion(pde_t *pgdir, uint start, uint end)
+{
+  acquire(&pgdirs.lock);
+  regionadd(vmspace(pgdir), (uint)PGROUNDDOWN(start), PGROUNDUP(end));
+  release(&pgdirs.lock);
+}
+
+// Copy the regions of pgdir to r, which has room for NREGION, and
+// return how many there are.
+static int
+vmregions(pde_t *pgdir, struct region *r)
+{
+  struct vmspace *s;
+  int n;
+
+  acquire(&pgdirs.lock);
+  s = vmspace(pgdir);
+  n = s->nregion;
+  memmove(r, s->region, n * sizeof(*r));
+  release(&pgdirs.lock);
+  return n;
+}
+
+// Free the page table for the 4M region at va if it maps nothing
+// and nothing else can be using it: pgdir has no other thread that
+// might be resolving a fault in it, nor another holder (swap, ksmd,
+// a userfault handler) walking it.  Returns 1 if freed.
+static int
+freeptab(pde_t *pgdir, uint va)
+{
+  pde_t *pde;
+  pte_t *pgtab;
+  int i;
+
+  pde = &pgdir[PDX(va)];
+  if((*pde & (PTE_P|PTE_PS)) != PTE_P)
+    return 0;
+  pgtab = (pte_t*)KADDR(PTE_ADDR(*pde));
+  for(i = 0; i < NPTENTRIES; i++)
+    if(pgtab[i])
+      return 0;
+  acquire(&pgdirs.lock);
+  if(vmspace(pgdir)->ref > 1){
+    release(&pgdirs.lock);
+    return 0;
+  }
+  *pde = 0;
+  release(&pgdirs.lock);
+  kfree((char*)pgtab);
+  return 1;
+}
+
+static int
+overlimit(uint *use, uint *limit, int n, int h)
+{
+  return (n > 0 && use[0] + n > limit[0]) || (h > 0 && use[1] + h > limit[1]);
+}
+
+// Charge n pages and h huge pages, either of which may be negative,
+// to pgdir and every tree limit around it.  Returns -1, charging
+// nothing, if that would go over a limit.
+static int
+vmcharge(pde_t *pgdir, int n, int h)
+{
+  struct vmspace *s;
+  struct mgroup *g;
+
+  acquire(&pgdirs.lock);
+  if((s = vmspace(pgdir)) == 0)
+    panic("vmcharge");
+  if(overlimit(s->use, s->limit, n, h))
+    goto over;
+  // Whatever the limits, no address space is charged more pages than
+  // memory and swap together could hold: sbrk() only reserves pages,
+  // and one reserved past that would fault with nowhere to go.
+  if(n > 0 && s->use[0] + n > physend / PGSIZE + NSWAPPG)
+    goto over;
+  for(g = s->group; g; g = g->parent)
+    if(overlimit(g->use, g->limit, n, h))
+      goto over;
+  s->use[0] += n;
+  s->use[1] += h;
+  for(g = s->group; g; g = g->parent){
+    g->use[0] += n;
+    g->use[1] += h;
+  }
+  release(&pgdirs.lock);
+  return 0;
+
+over:
+  release(&pgdirs.lock);
+  return -1;
+}
+
+// Drop a reference to a tree limit.  Caller holds pgdirs.lock.
+static void
+mgroupput(struct mgroup *g)
+{
+  struct mgroup *parent;
+
+  while(g && --g->ref == 0){
+    parent = g->parent;
+    g->leader = 0;
+    g->parent = 0;
+    g = parent;
+  }
+}
+
+// Lower one of pgdir's limits (resource is an RLIMIT_*), or start
+// a new tree limit for it.
+int
+vmsetlimit(pde_t *pgdir, int resource, uint limit)
+{
+  struct vmspace *s;
+  struct mgroup *g;
+  int i;
+
+  if(resource < 0 || resource >= RLIM_NLIMITS)
+    return -1;
+  acquire(&pgdirs.lock);
+  s = vmspace(pgdir);
+  if(resource < RLIMIT_TREEPAGES){
+    if(limit > s->limit[resource])
+      goto bad;
+    s->limit[resource] = limit;
+    release(&pgdirs.lock);
+    return 0;
+  }
+
+  i = resource - RLIMIT_TREEPAGES;
+  if((g = s->group) != 0 && g->leader == s){
+    if(limit > g->limit[i])
+      goto bad;
+    g->limit[i] = limit;
+    release(&pgdirs.lock);
+    return 0;
+  }
+  // The new group takes over this space's reference to the group
+  // around it, which already counts the space's memory.
+  for(g = pgdirs.group; g < &pgdirs.group[NVMSPACE]; g++)
+    if(g->ref == 0)
+      break;
+  if(g == &pgdirs.group[NVMSPACE])
+    goto bad;
+  g->ref = 1;
+  g->leader = s;
+  g->parent = s->group;
+  g->use[0] = s->use[0];
+  g->use[1] = s->use[1];
+  g->limit[0] = g->limit[1] = RLIM_INFINITY;
+  g->limit[i] = limit;
+  s->group = g;
+  release(&pgdirs.lock);
+  return 0;
+
+bad:
+  release(&pgdirs.lock);
+  return -1;
+}
+
+// Report one of pgdir's limits and its current use.  For a tree
+// limit, that is the innermost tree limit pgdir is inside.
+int
+vmgetlimit(pde_t *pgdir, int resource, struct rlimit *rl)
+{
+  struct vmspace *s;
+  int i;
 
+  if(resource < 0 || resource >= RLIM_NLIMITS)
+    return -1;
+  acquire(&pgdirs.lock);
+  s = vmspace(pgdir);
+  i = resource % 2;
+  if(resource < RLIMIT_TREEPAGES || s->group == 0){
+    rl->limit = resource < RLIMIT_TREEPAGES ? s->limit[i] : RLIM_INFINITY;
+    rl->use = s->use[i];
+  } else {
+    rl->limit = s->group->limit[i];
+    rl->use = s->group->use[i];
+  }
+  release(&pgdirs.lock);
+  return 0;
+}
 
 // Turn on paging.
 void
 vmenable(void)
 {
-  uint cr0;
+  uint cr0, cr4;
 
+  // CR4_PAE has to be set before paging is turned on.
+  cr4 = rcr4();
+  cr4 |= CR4_PSE;
+#ifdef PAE
+  cr4 |= CR4_PAE;
+#endif
+  lcr4(cr4);
   switchkvm(); // load kpgdir into cr3
   cr0 = rcr0();
-  cr0 |= CR0_PG;
+  // With CR0_WP the kernel cannot write to the zero pages through
+  // user mappings either.
+  cr0 |= CR0_PG | CR0_WP;
   lcr0(cr0);
-    uint cr4;
-    cr4 = rcr4();
-    cr4 |= CR4_PSE;
-    lcr4(cr4);
 }
 // Switch h/w page table register to the kernel-only page table,
 // for when no process is running.
 void
 switchkvm(void)
 {
-  lcr3(PADDR(kpgdir));   // switch to the kernel page table
+  lcr3(CR3(kpgdir));   // switch to the kernel page table
 }
 
 // Switch TSS and h/w page table to correspond to process p.
@@ -210,7 +799,7 @@ switchuvm(struct proc *p)
   ltr(SEG_TSS << 3);
   if(p->pgdir == 0)
     panic("switchuvm: no pgdir");
-  lcr3(PADDR(p->pgdir));  // switch to new address space
+  lcr3(CR3(p->pgdir));  // switch to new address space
   popcli();
 }
 
@@ -223,6 +812,8 @@ inituvm(pde_t *pgdir, char *init, uint sz)
   
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
+  vmcharge(pgdir, 1, 0);
+  vmregion(pgdir, 0, PGSIZE);
   mem = kalloc();
   memset(mem, 0, PGSIZE);
   mappages(pgdir, 0, PGSIZE, PADDR(mem), PTE_W|PTE_U);
@@ -258,12 +849,39 @@ loaduvm(pde_t *pgdir, char *addr, struct inode *ip, uint offset, uint sz)
       n = sz - i;
     else
       n = diff;
-    if(readi(ip, (char*)pa, offset+i, n) != n)
+    if(readi(ip, (char*)KADDR(pa), offset+i, n) != n)
       return -1;
   }
   return 0;
 }
 
+// Allocate a size-byte frame for user memory.  When memory is short,
+// 4K frames are made by swapping out other pages; a huge page is not
+// worth that much I/O, so callers fall back to 4K pages instead.
+// Nothing may be evictable for a while when the other processes are
+// all in the middle of faults or disk transfers of their own, so a
+// failed swapout() is retried a tick later, up to SWAPWAIT times.
+static char*
+uvmalloc(uint size)
+{
+  char *mem;
+  int n;
+
+  n = 0;
+  while((mem = buddy_alloc(size)) == 0){
+    if(size != PGSIZE || proc == 0)
+      return 0;
+    if(swapout() < 0){
+      if(n++ == SWAPWAIT || proc->killed)
+        return 0;
+      acquire(&tickslock);
+      sleeptimeout(&n, &tickslock, 1);
+      release(&tickslock);
+    }
+  }
+  return mem;
+}
+
 // Allocate page tables and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
 int
@@ -277,145 +895,481 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   if(newsz < oldsz)
     return oldsz;
   a = PGROUNDUP(oldsz);
+  vmregion(pgdir, a, newsz);
   uint diff = PGSIZE; //represents how much memory has been alloced in this iteration
-  uint bytes_left = PGROUNDUP(newsz) - a;
   for(; a < newsz; a += diff){
 
     //conditions where a huge page can be allocated:
     // 1: need to allocate at least 4M of space
     // 2: Needs 4M alignment
+    // 3: no page table there already (left by a shrink, or the stack's)
+    // 4: the huge page quota allows it
 
-    if(a % MAXPGSIZE == 0 && bytes_left >= MAXPGSIZE) {
+    mem = 0;
+    if(a % MAXPGSIZE == 0 && PGROUNDUP(newsz) - a >= MAXPGSIZE &&
+       pgdir[PDX(a)] == 0 && vmcharge(pgdir, NPTENTRIES, 1) == 0) {
         diff = MAXPGSIZE;
-    } else {
-        diff = PGSIZE;
+        if((mem = uvmalloc(diff)) == 0)
+            vmcharge(pgdir, -NPTENTRIES, -1);
     }
-    mem = buddy_alloc(diff);
-    if(mem == 0 && diff == MAXPGSIZE) {
+    if(mem == 0) {
      //if we failed to get a huge page, try to get a regular page
      diff = PGSIZE;
-     mem = buddy_alloc(diff);
- 
+     if(vmcharge(pgdir, 1, 0) < 0){
+       cprintf("allocuvm over memory limit\n");
+       deallocuvm(pgdir, newsz, oldsz);
+       return 0;
+     }
+     if((mem = uvmalloc(diff)) == 0){
+       cprintf("allocuvm out of memory\n");
+       vmcharge(pgdir, -1, 0);
+       deallocuvm(pgdir, newsz, oldsz);
+       return 0;
+     }
+    }
+    memset(mem, 0, diff);
+    // Count new pages as used, so the clock does not evict them first.
+    mappages(pgdir, (char*)a, diff, PADDR(mem), PTE_W|PTE_U|PTE_A);
+  }
+  return newsz;
+}
+
+// Grow process from oldsz to newsz like allocuvm(), but only reserve
+// the pages, to be zero-filled on demand.  They are charged now, so
+// going over a limit fails here and not at a later fault.  Pages
+// above oldsz that an earlier call reserved (see growproc()) are
+// left as they are.  Returns new size or 0 on error.
+int
+zerouvm(pde_t *pgdir, uint oldsz, uint newsz)
+{
+  pte_t *pte, *pgtab;
+  uint a;
+
+  if(newsz > USERTOP)
+    return 0;
+  if(newsz < oldsz)
+    return oldsz;
+  vmregion(pgdir, oldsz, newsz);
+  for(a = PGROUNDUP(oldsz); a < newsz; ){
+    if(pgdir[PDX(a)] & PTE_PS){
+      a = ROUNDUP(a + 1, MAXSIZE);
+      continue;
     }
-    if(mem == 0){
-              
-      cprintf("allocuvm out of memory\n");
+    if(a % MAXPGSIZE == 0 && PGROUNDUP(newsz) - a >= MAXPGSIZE &&
+       pgdir[PDX(a)] == 0){
+      if(vmcharge(pgdir, NPTENTRIES, 0) < 0)
+        goto over;
+      pgdir[PDX(a)] = ZEROENTRY | PTE_PS;
+      a += MAXPGSIZE;
+      continue;
+    }
+    // The page table comes from uvmalloc(), which can swap to make
+    // room, as the pages it will map do.
+    if(!(pgdir[PDX(a)] & PTE_P) && (pgtab = (pte_t*)uvmalloc(PGSIZE)) != 0){
+      memset(pgtab, 0, PGSIZE);
+      pgdir[PDX(a)] = PADDR(pgtab) | PTE_P | PTE_W | PTE_U;
+    }
+    if((pte = walkpgdir(pgdir, (char*)a, 0)) == 0){
+      cprintf("zerouvm out of memory\n");
       deallocuvm(pgdir, newsz, oldsz);
       return 0;
     }
-    memset(mem, 0, diff);
-    mappages(pgdir, (char*)a, diff, PADDR(mem), PTE_W|PTE_U);
+    if(*pte == 0){
+      if(vmcharge(pgdir, 1, 0) < 0)
+        goto over;
+      *pte = ZEROENTRY;
+    }
+    a += PGSIZE;
   }
   return newsz;
+
+over:
+  cprintf("zerouvm over memory limit\n");
+  deallocuvm(pgdir, newsz, oldsz);
+  return 0;
+}
+
+// The PTE for 4K page i of the huge page that PDE e maps, has
+// swapped out, or has reserved.
+static pte_t
+hugepte(pde_t e, int i)
+{
+  if(ISZEROFILL(e))
+    return ZEROENTRY;
+  if(e & PTE_P)
+    return (PTE_ADDR(e) + i*PGSIZE) | (e & (PTE_W|PTE_U)) | PTE_P;
+  return SWAPENTRY(SWAPSLOT(e) + i, e & ~PTE_PS);
+}
+
+// Map the huge page at va in pgdir, resident, swapped out or
+// reserved, with 4K pages instead, using page table page pgtab, or a
+// new one if it is 0.  Returns -1 if there is no memory for it.
+static int
+splitpde(pde_t *pgdir, uint va, pte_t *pgtab)
+{
+  pde_t *pde;
+  int i;
+
+  if(pgtab == 0 && (pgtab = (pte_t*)kalloc()) == 0)
+    return -1;
+  pde = &pgdir[PDX(va)];
+  for(i = 0; i < NPTENTRIES; i++)
+    pgtab[i] = hugepte(*pde, i);
+  // Only a private huge page was charged as one.
+  if(!ISZEROFILL(*pde) && !zeromapped(*pde)){
+    if(*pde & PTE_P)
+      buddy_split((void*)KADDR(PTE_ADDR(*pde)));
+    vmcharge(pgdir, 0, -1);
+  }
+  rmaplock();
+  if(tracked(*pde))
+    rmapsplit(PTE_ADDR(*pde), pgdir, ROUNDDOWN(va, MAXSIZE));
+  *pde = PADDR(pgtab) | PTE_P | PTE_W | PTE_U;
+  rmapunlock();
+  if(proc && pgdir == proc->pgdir)
+    lcr3(CR3(pgdir));
+  return 0;
 }
 
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
-// process size.  Returns the new process size.
+// process size.  Only the regions are walked, and page tables left
+// empty are freed.  Returns the new process size.
 int
 deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 {
-  pte_t *pte;
+  struct region r[NREGION];
+  pte_t *pte, e;
   pte_t* pde;
-  uint a, pa;
+  uint a, va, pa, start, end;
+  int i, nr, n, h, z, freed;
 
   if(newsz >= oldsz)
     return oldsz;
 
   a = PGROUNDUP(newsz);
+  // If only the top of a huge page goes, map it with 4K pages first,
+  // or failing that keep all of it.
+  if(a % MAXPGSIZE && (pgdir[PDX(a)] & PTE_PS) && splitpde(pgdir, a, 0) < 0)
+    a = newsz = ROUNDDOWN(a, MAXSIZE) + MAXPGSIZE;
+  start = a;
+  end = PGROUNDUP(oldsz);
+  n = h = z = 0;
   uint diff = PGSIZE;
-  for(; a  < oldsz; a += diff){
-    //get the page directory entry for the address
-    pde = &pgdir[PDX(a)];
-    if((*pde & PTE_PS) && (*pde & PTE_P)) {
-        diff = MAXPGSIZE;
-        pa = PTE_ADDR(*pde);
-        if(pa == 0)
-            panic("kfree");
-        kfree((char*)pa);
-    } else {
+  nr = vmregions(pgdir, r);
+  for(i = 0; i < nr; i++){
+    for(a = r[i].start > start ? r[i].start : start; a < r[i].end && a < end; a += diff){
+      //get the page directory entry for the address
+      pde = &pgdir[PDX(a)];
+      if(*pde & PTE_PS) {
+        diff = MAXPGSIZE - a % MAXPGSIZE;
+        va = ROUNDDOWN(a, MAXSIZE);
+        pte = pde;
+        n += NPTENTRIES;
+        if(zeromapped(*pde))
+          z += NPTENTRIES;
+        else if((*pde & PTE_P) || ISSWAPPED(*pde))
+          h++;
+      } else if(*pde & PTE_P) {
         diff = PGSIZE;
-        pte = walkpgdir(pgdir, (char*)a, 0);
-        if(pte && (*pte & PTE_P) != 0){
-            pa = PTE_ADDR(*pte);
-            if(pa == 0)
-                panic("kfree");
-            kfree((char*)pa);
-            *pte = 0;
-        }
+        va = a;
+        pte = &((pte_t*)KADDR(PTE_ADDR(*pde)))[PTX(a)];
+        if(*pte == 0)
+          continue;
+        n++;
+        if(zeromapped(*pte))
+          z++;
+      } else {
+        // No page table: nothing mapped up to the next one.
+        diff = MAXPGSIZE - a % MAXPGSIZE;
+        continue;
+      }
+      e = putpte(pgdir, va, pte, 0);
+      // Reserved and zero pages have no memory of their own.
+      if((e & PTE_P) && !zeromapped(e)){
+        pa = PTE_ADDR(e);
+        if(pa == 0)
+          panic("kfree");
+        if(e & PTE_SHR)
+          ksmput((char*)KADDR(pa));
+        else
+          kfree((char*)KADDR(pa));
+      } else if(ISSWAPPED(e))
+        swapfree(SWAPSLOT(e), (e & PTE_PS) ? NPTENTRIES : 1);
     }
+  }
+  vmcharge(pgdir, -n, -h);
+  if(z)
+    zerocount(-z);
+
+  freed = 0;
+  for(a = ROUNDDOWN(start, MAXSIZE); a < end && a < USERTOP; a += MAXPGSIZE)
+    freed |= freeptab(pgdir, a);
+  acquire(&pgdirs.lock);
+  regiondel(vmspace(pgdir), start, end);
+  release(&pgdirs.lock);
+  if(freed && proc && pgdir == proc->pgdir)
+    lcr3(CR3(pgdir));
+  return newsz;
+}
+
+// Add a reference to pgdir for a new thread that will share it, or
+// for anything else that needs it to stay around.  Each reference is
+// dropped by one call to freevm().
+void
+vmshare(pde_t *pgdir)
+{
+  struct vmspace *s;
+
+  acquire(&pgdirs.lock);
+  if((s = vmspace(pgdir)) == 0)
+    panic("vmshare");
+  s->ref++;
+  release(&pgdirs.lock);
+}
+
+// Lock pgdir's layout against the other threads sharing it: sz and
+// stack, and the mappings growproc(), clone(), exec() and stack growth
+// make or tear down.  Sleeps while another thread holds it, so the
+// caller must hold no spinlock.  Page faults do not take it.
+void
+vmlock(pde_t *pgdir)
+{
+  struct vmspace *s;
+
+  acquire(&pgdirs.lock);
+  if((s = vmspace(pgdir)) == 0)
+    panic("vmlock");
+  while(s->busy)
+    sleep(s, &pgdirs.lock);
+  s->busy = 1;
+  release(&pgdirs.lock);
+}
 
+void
+vmunlock(pde_t *pgdir)
+{
+  struct vmspace *s;
+
+  acquire(&pgdirs.lock);
+  if((s = vmspace(pgdir)) == 0 || !s->busy)
+    panic("vmunlock");
+  s->busy = 0;
+  wakeup(s);
+  release(&pgdirs.lock);
+}
 
+// Is pgdir shared with another thread, or held by anything else?
+static int
+vmshared(pde_t *pgdir)
+{
+  int r;
+
+  acquire(&pgdirs.lock);
+  r = vmspace(pgdir)->ref > 1;
+  release(&pgdirs.lock);
+  return r;
+}
+
+// Replace the merged page that *pte, the PTE for va in pgdir, maps
+// (see ksm.c) with a private copy.  Returns -1 if out of memory.
+static int
+unmerge(pde_t *pgdir, uint va, pte_t *pte)
+{
+  char *frame, *mem;
+
+  frame = (char*)KADDR(PTE_ADDR(*pte));
+  if(ksmlast(frame))
+    mem = frame;
+  else {
+    if((mem = uvmalloc(PGSIZE)) == 0)
+      return -1;
+    memmove(mem, frame, PGSIZE);
+    ksmput(frame);
   }
-  return newsz;
+  putpte(pgdir, va, pte, PADDR(mem) | PTE_W | PTE_U | PTE_P | PTE_A | PTE_D);
+  return 0;
+}
+
+// Give pgdir private pages in place of its zero and merged pages,
+// turning zero page mappings back into reserved pages.  Called by
+// the current process before a second thread shares pgdir: with no
+// TLB shootdown, replacing a shared page on a write could leave
+// other CPUs using the stale shared frame, so address spaces with
+// threads get private pages only (see zerofault() and ksm.c).
+// Returns -1 if out of memory.
+int
+vmunshare(pde_t *pgdir)
+{
+  pde_t *pde;
+  pte_t *pgtab;
+  int i, z, r;
+
+  z = r = 0;
+  for(pde = pgdir; pde < &pgdir[PDX(USERTOP)]; pde++){
+    if(*pde & PTE_PS){
+      if(zeromapped(*pde)){
+        *pde = ZEROENTRY | PTE_PS;
+        z += NPTENTRIES;
+      }
+    } else if(*pde & PTE_P){
+      pgtab = (pte_t*)KADDR(PTE_ADDR(*pde));
+      for(i = 0; i < NPTENTRIES && r == 0; i++){
+        if(zeromapped(pgtab[i])){
+          pgtab[i] = ZEROENTRY;
+          z++;
+        } else if((pgtab[i] & (PTE_P|PTE_SHR)) == (PTE_P|PTE_SHR))
+          r = unmerge(pgdir, PGADDR(pde - pgdir, i, 0), &pgtab[i]);
+      }
+    }
+  }
+  if(z)
+    zerocount(-z);
+  lcr3(CR3(pgdir));
+  return r;
 }
 
 // Free a page table and all the physical memory pages
-// in the user part.
+// in the user part, once the last reference to it is gone.
 void
 freevm(pde_t *pgdir)
 {
-  uint i;
+  struct vmspace *s;
 
   if(pgdir == 0)
     panic("freevm: no pgdir");
-  deallocuvm(pgdir, USERTOP, 0x000);
-  for(i = 0; i < NPDENTRIES; i++){
-    if(pgdir[i] & PTE_P)
-      kfree((char*)PTE_ADDR(pgdir[i]));
+  acquire(&pgdirs.lock);
+  if((s = vmspace(pgdir)) == 0)
+    panic("freevm: not a user pgdir");
+  if(--s->ref > 0){
+    release(&pgdirs.lock);
+    return;
   }
-  kfree((char*)pgdir);
+  release(&pgdirs.lock);
+
+  deallocuvm(pgdir, USERTOP, 0x000);
+
+  acquire(&pgdirs.lock);
+  if(s->group && s->group->leader == s)
+    s->group->leader = 0;
+  mgroupput(s->group);
+  s->pgdir = 0;
+  release(&pgdirs.lock);
+  freepgdir(pgdir);
 }
 
-// Given a parent process's page table, create a copy
-// of it for a child.
-pde_t*
-copyuvm(pde_t *pgdir, uint sz)
+// Give d the reserved, zero or merged page entry e at va as well;
+// such pages need no copy.  Returns -1 if out of memory or over d's
+// limits, or 1 if the reverse map is full and the page must be
+// copied after all.
+static int
+copyshared(pde_t *d, uint va, pte_t e, uint size)
 {
-  pde_t *d;
   pte_t *pte;
-  pde_t* pde;
-  uint pa, i;
+
+  if(vmcharge(d, size / PGSIZE, 0) < 0)
+    return -1;
+  if(size == MAXPGSIZE)
+    pte = &d[PDX(va)];
+  else if((pte = walkpgdir(d, (void*)va, 1)) == 0){
+    vmcharge(d, -1, 0);
+    return -1;
+  }
+  if(setpte(d, va, pte, 0, e) < 0){
+    vmcharge(d, -(size / PGSIZE), 0);
+    return 1;
+  }
+  if(zeromapped(e))
+    zerocount(size / PGSIZE);
+  else if(e & PTE_SHR)
+    ksmget((char*)KADDR(PTE_ADDR(e)));
+  return 0;
+}
+
+// Map a new size-byte page at va in d holding a copy of the page
+// that entry e maps, or has swapped out.  Returns -1 if out of
+// memory or over d's limits.
+static int
+copyframe(pde_t *d, uint va, pte_t e, uint size)
+{
   char *mem;
+  int n, h, r;
+
+  if((ISZEROFILL(e) || zeromapped(e) || (e & PTE_SHR)) &&
+     (r = copyshared(d, va, e, size)) <= 0)
+    return r;
 
-  if((d = setupkvm()) == 0)
+  // Pages handed to a userfault handler may be missing;
+  // the child simply does not get them.
+  if(!(e & (PTE_P|PTE_SWP)))
     return 0;
-  uint diff = PGSIZE;
-  for(i = PGSIZE; i < sz; i += diff){
-    pde = &pgdir[PDX(i)];
-    if((*pde & PTE_PS) && (*pde & PTE_P)) {
-        diff = MAXPGSIZE;
-        pa = PTE_ADDR(*pde);
-    } else {
-    
-        diff = PGSIZE;
-        if((pte = walkpgdir(pgdir, (void*)i, 0)) == 0)
-          panic("copyuvm: pte should exist");
-        if(!(*pte & PTE_P))
-          panic("copyuvm: page not present");
-        pa = PTE_ADDR(*pte);
-    }
-    if((mem = buddy_alloc(diff)) == 0)
-      goto bad;
-    memmove(mem, (char*)pa, diff);
-    if(mappages(d, (void*)i, diff, PADDR(mem), PTE_W|PTE_U) < 0)
-      goto bad;
+  n = size / PGSIZE;
+  h = size == MAXPGSIZE;
+  if(vmcharge(d, n, h) < 0)
+    return -1;
+  if((mem = uvmalloc(size)) == 0){
+    vmcharge(d, -n, -h);
+    return -1;
   }
+  if(e & PTE_P)
+    memmove(mem, (char*)KADDR(PTE_ADDR(e)), size);
+  else
+    swapread(SWAPSLOT(e), mem, n);
+  if(mappages(d, (void*)va, size, PADDR(mem), PTE_W|PTE_U) < 0){
+    kfree(mem);
+    vmcharge(d, -n, -h);
+    return -1;
+  }
+  return 0;
+}
 
-  for(int j  = (uint)proc->stack; j < USERTOP; j += PGSIZE) {
-    if((pte = walkpgdir(pgdir, (void*)j, 0)) == 0)
-      panic("copyuvm: pte should exist");
-    if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
-    pa = PTE_ADDR(*pte);
-    if((mem = buddy_alloc(PGSIZE)) == 0)
-      goto bad;
-    memmove(mem, (char*)pa, PGSIZE );
-    if(mappages(d, (void*)j, PGSIZE, PADDR(mem), PTE_W|PTE_U) < 0)
-      goto bad;
+// Copy the page at user address va in pgdir to va in d.  A huge
+// page is copied as 4K pages if d may not have another huge page or
+// no 4M frame is free.  Sets *size to the size of the page, or to
+// the distance to the next page table if va has none.
+static int
+copypage(pde_t *pgdir, pde_t *d, uint va, uint *size)
+{
+  pte_t *pte, e;
+  int i;
 
+  if(pgdir[PDX(va)] & PTE_PS){
+    *size = MAXPGSIZE;
+    e = pgdir[PDX(va)];
+    if(copyframe(d, va, e, MAXPGSIZE) == 0)
+      return 0;
+    for(i = 0; i < NPTENTRIES; i++)
+      if(copyframe(d, va + i*PGSIZE, hugepte(e, i), PGSIZE) < 0)
+        return -1;
+    return 0;
+  }
+  if((pte = walkpgdir(pgdir, (void*)va, 0)) == 0){
+    *size = MAXPGSIZE - va % MAXPGSIZE;
+    return 0;
+  }
+  *size = PGSIZE;
+  return copyframe(d, va, *pte, PGSIZE);
+}
+
+// Given a parent process's page table, create a copy
+// of it for a child, region by region.
+pde_t*
+copyuvm(pde_t *pgdir)
+{
+  struct region r[NREGION];
+  pde_t *d;
+  uint a, diff;
+  int i, nr;
 
+  if((d = setupuvm(pgdir)) == 0)
+    return 0;
+  nr = vmregions(pgdir, r);
+  for(i = 0; i < nr; i++){
+    vmregion(d, r[i].start, r[i].end);
+    for(a = r[i].start; a < r[i].end; a += diff)
+      if(copypage(pgdir, d, a, &diff) < 0)
+        goto bad;
   }
   return d;
 
@@ -424,6 +1378,20 @@ bad:
   return 0;
 }
 
+// The entry mapping user address va in pgdir: the PDE of a huge
+// page, the PTE of a 4K page, or 0.
+static pte_t
+uvaentry(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+
+  if(pgdir[PDX(va)] & PTE_PS)
+    return pgdir[PDX(va)];
+  if((pte = walkpgdir(pgdir, (void*)va, 0)) == 0)
+    return 0;
+  return *pte;
+}
+
 // Map user virtual address to kernel physical address.
 char*
 uva2ka(pde_t *pgdir, char *uva)
@@ -436,19 +1404,37 @@ uva2ka(pde_t *pgdir, char *uva)
         return 0;
       if((*pde & PTE_U) == 0)
         return 0;
-      return (char*)PTE_ADDR(*pde);
+      return (char*)KADDR(PTE_ADDR(*pde));
   } 
       pte = walkpgdir(pgdir, uva, 0);
-      if((*pte & PTE_P) == 0)
+      if(pte == 0 || (*pte & PTE_P) == 0)
         return 0;
       if((*pte & PTE_U) == 0)
         return 0;
-      return (char*)PTE_ADDR(*pte);
+      return (char*)KADDR(PTE_ADDR(*pte));
+}
+
+// Map user virtual address to the physical address of the byte it
+// names, whichever page size backs it.  Returns 0 if not mapped.
+uint
+uva2pa(pde_t *pgdir, uint va)
+{
+  char *pa;
+
+  if((pgdir[PDX(va)] & (PTE_P|PTE_PS)) == (PTE_P|PTE_PS)){
+    if((pa = uva2ka(pgdir, (char*)va)) == 0)
+      return 0;
+    return PADDR(pa) + va % MAXPGSIZE;
+  }
+  if((pa = uva2ka(pgdir, PGROUNDDOWN(va))) == 0)
+    return 0;
+  return PADDR(pa) + va % PGSIZE;
 }
 
 // Copy len bytes from p to user address va in page table pgdir.
 // Most useful when pgdir is not the current page table.
-// uva2ka ensures this only works for PTE_U pages.
+// uva2ka ensures this only works for PTE_U pages; read-only pages,
+// such as zero pages and merged pages, are refused too.
 int
 copyout(pde_t *pgdir, uint va, void *p, uint len)
 {
@@ -468,7 +1454,7 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
         va0 = (uint)PGROUNDDOWN(va);
     }
     pa0 = uva2ka(pgdir, (char*)va0);
-    if(pa0 == 0)
+    if(pa0 == 0 || !(uvaentry(pgdir, va0) & PTE_W))
       return -1;
     n = diff - (va - va0);
     if(n > len)
@@ -480,3 +1466,570 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
   }
   return 0;
 }
+
+// Remove and free the user pages in [start, end), which must be
+// page aligned.  A huge page, resident or swapped out, must lie
+// entirely inside the range.
+// Returns -1 without changing anything if one does not.
+int
+uvmunmap(pde_t *pgdir, uint start, uint end)
+{
+  uint a;
+
+  if(start % PGSIZE || end % PGSIZE || start > end || end > USERTOP)
+    return -1;
+  for(a = ROUNDDOWN(start, MAXSIZE); a < end; a += MAXPGSIZE)
+    if((pgdir[PDX(a)] & PTE_PS) && (a < start || a + MAXPGSIZE > end))
+      return -1;
+  deallocuvm(pgdir, end, start);
+  return 0;
+}
+
+// Map the size-byte page mem (PGSIZE or MAXPGSIZE) at user address
+// va, which must be aligned to size.  Returns -1 if something is
+// already mapped, swapped out or reserved there, if a page table is in
+// the way of a huge page, or if the page would go over pgdir's limits.
+// An empty page table is not freed to make room: threads of pgdir may
+// be running on other CPUs, whose TLBs we cannot flush.  Caller holds
+// vmlock(pgdir).
+int
+uvmmap(pde_t *pgdir, uint va, char *mem, uint size)
+{
+  pde_t *pde;
+  pte_t *pte;
+
+  if(va % size || va + size > USERTOP)
+    return -1;
+  pde = &pgdir[PDX(va)];
+  if(*pde & PTE_PS)
+    return -1;
+  if(size == MAXPGSIZE && (*pde & PTE_P))
+    return -1;
+  if(size == PGSIZE && (pte = walkpgdir(pgdir, (void*)va, 0)) != 0 && *pte)
+    return -1;
+  if(vmcharge(pgdir, size / PGSIZE, size == MAXPGSIZE) < 0)
+    return -1;
+  vmregion(pgdir, va, va + size);
+  if(mappages(pgdir, (void*)va, size, PADDR(mem), PTE_W|PTE_U) < 0){
+    vmcharge(pgdir, -(size / PGSIZE), -(size == MAXPGSIZE));
+    return -1;
+  }
+  return 0;
+}
+
+// Find the next page of pgdir from the clock hand that has not been
+// used since the hand last passed it, clearing accessed bits on the
+// way.  Returns its PTE (a PDE for a huge page) and sets *va, or
+// returns 0 at the end of the address space.  Caller holds
+// swaplock(pgdir).
+static pte_t*
+clockscan(pde_t *pgdir, uint *va)
+{
+  pde_t *pde;
+  pte_t *pte;
+
+  while(hand.va < USERTOP){
+    pde = &pgdir[PDX(hand.va)];
+    if(!(*pde & PTE_P) || (*pde & PTE_PS)){
+      *va = ROUNDDOWN(hand.va, MAXSIZE);
+      hand.va = *va + MAXPGSIZE;
+      pte = pde;
+    } else {
+      *va = hand.va;
+      hand.va += PGSIZE;
+      pte = &((pte_t*)KADDR(PTE_ADDR(*pde)))[PTX(*va)];
+    }
+    // Shared frames stay.
+    if((*pte & (PTE_P|PTE_U)) != (PTE_P|PTE_U) || zeromapped(*pte) ||
+       (*pte & PTE_SHR))
+      continue;
+    if(!(*pte & PTE_A))
+      return pte;
+    *pte &= ~PTE_A;
+  }
+  return 0;
+}
+
+// Return the entry mapping the size-byte page at va, or 0.
+static pte_t*
+pageentry(pde_t *pgdir, uint va, uint size)
+{
+  pde_t *pde;
+
+  pde = &pgdir[PDX(va)];
+  if(size == MAXPGSIZE)
+    return pde;
+  if((*pde & (PTE_P|PTE_PS)) != PTE_P)
+    return 0;
+  return &((pte_t*)KADDR(PTE_ADDR(*pde)))[PTX(va)];
+}
+
+// Return the PTE of the 4K page at user address va in pgdir, or 0
+// if there is no page table for va.
+pte_t*
+uvmpte(pde_t *pgdir, uint va)
+{
+  return pageentry(pgdir, va, PGSIZE);
+}
+
+// The entry recorded in the reverse map for va in pgdir: the PDE
+// of a huge page or the PTE of a 4K page.
+static pte_t*
+rmapentry(pde_t *pgdir, uint va)
+{
+  if(pgdir[PDX(va)] & PTE_PS)
+    return &pgdir[PDX(va)];
+  return pageentry(pgdir, va, PGSIZE);
+}
+
+// rmapwalk() callback: may the mapping be changed now?
+static int
+framebusy(pde_t *pgdir, uint va, void *arg)
+{
+  // Merged frames are left to ksm.c.
+  if(!swapalso(pgdir) || (*rmapentry(pgdir, va) & PTE_SHR))
+    return -1;
+  return 0;
+}
+
+// Lock the process table and the reverse map, so that no thread
+// using the user frame at pa runs and its mappings stay put.
+// Returns 0 with both locked, 1 with neither if pa is not mapped,
+// or -1 with neither if an address space mapping it is busy.
+static int
+lockframe(uint pa)
+{
+  pde_t *pgdir;
+  int r;
+
+  rmaplock();
+  pgdir = rmapfirst(pa);
+  rmapunlock();
+  if(pgdir == 0)
+    return 1;
+  if(!swaplock(pgdir))
+    return -1;
+  rmaplock();
+  r = rmapfirst(pa) == 0 ? 1 : rmapwalk(pa, framebusy, 0);
+  if(r != 0){
+    rmapunlock();
+    swapunlock();
+  }
+  return r;
+}
+
+// rmapwalk() callback: map the copy arg in place of the frame.
+static int
+frameretarget(pde_t *pgdir, uint va, void *arg)
+{
+  pte_t *pte;
+
+  pte = rmapentry(pgdir, va);
+  *pte = PADDR(arg) | (*pte & 0xFFF);
+  return 0;
+}
+
+// Map the user frame old, a 4K frame or a huge page, at new instead
+// in every address space, for moving its contents elsewhere.  new
+// must be a copy of old, of the same size, not mapped anywhere.
+// Returns 0 if done, leaving old to the caller to free; 1 if old is
+// not mapped; or -1, changing nothing, if an address space mapping
+// old is in use or old is a merged frame.
+int
+frameremap(char *old, char *new)
+{
+  int r;
+
+  if((r = lockframe(PADDR(old))) != 0)
+    return r;
+  rmapwalk(PADDR(old), frameretarget, new);
+  rmapmove(PADDR(old), PADDR(new));
+  rmapunlock();
+  swapunlock();
+  if(proc)
+    lcr3(CR3(proc->pgdir));
+  return 0;
+}
+
+// rmapwalk() callback: drop the mapping and uncharge it.
+static int
+framedrop(pde_t *pgdir, uint va, void *arg)
+{
+  pte_t *pte;
+
+  pte = rmapentry(pgdir, va);
+  if(*pte & PTE_PS)
+    vmcharge(pgdir, -NPTENTRIES, -1);
+  else
+    vmcharge(pgdir, -1, 0);
+  *pte = 0;
+  return 0;
+}
+
+// Unmap the user frame, a 4K frame or a huge page, from every
+// address space, and free it.  A later access to one of its pages
+// faults as if it had never been mapped.  Returns 0 if done, 1 if
+// frame is not mapped, or -1 like frameremap().
+int
+frameunmap(char *frame)
+{
+  int r;
+
+  if((r = lockframe(PADDR(frame))) != 0)
+    return r;
+  rmapwalk(PADDR(frame), framedrop, 0);
+  rmapclear(PADDR(frame));
+  rmapunlock();
+  swapunlock();
+  kfree(frame);
+  if(proc)
+    lcr3(CR3(proc->pgdir));
+  return 0;
+}
+
+// Move (PAGE_MOVE) or drop (PAGE_DROP) the private frame backing
+// user address va of the current process with frameremap() or
+// frameunmap(), for testing the reverse map (include/pagectl.h).
+// Returns 0 if done, or -1 if va has no such frame or another thread
+// using it is running.
+int
+pagectl(uint va, int op)
+{
+  pte_t *pte;
+  char *old, *new;
+  uint size;
+  int r;
+
+  if(va >= USERTOP || (op != PAGE_MOVE && op != PAGE_DROP))
+    return -1;
+  size = (proc->pgdir[PDX(va)] & PTE_PS) ? MAXPGSIZE : PGSIZE;
+  if((pte = pageentry(proc->pgdir, va, size)) == 0 || !tracked(*pte) ||
+     (*pte & PTE_SHR))
+    return -1;
+  old = (char*)KADDR(PTE_ADDR(*pte));
+  new = 0;
+  if(op == PAGE_MOVE){
+    if((new = buddy_alloc(size)) == 0)
+      return -1;
+    memmove(new, old, size);
+  }
+  // Like a page fault, this holds no pointers into user memory.
+  proc->swappable = 1;
+  if(op == PAGE_DROP)
+    r = frameunmap(old);
+  else if((r = frameremap(old, new)) == 0)
+    kfree(old);
+  else
+    kfree(new);
+  proc->swappable = 0;
+  return r == 0 ? 0 : -1;
+}
+
+// Map the huge page at va, whose PDE was old, with 4K pages instead,
+// so they can be swapped out one at a time.  Returns -1 if there is
+// no memory for the page table.
+static int
+splithuge(pde_t *pgdir, uint va, pde_t old)
+{
+  pte_t *pgtab;
+  int i;
+
+  if((pgtab = (pte_t*)kalloc()) == 0)
+    return -1;
+  for(i = 0; i < NPTENTRIES; i++)
+    pgtab[i] = hugepte(old, i);
+  if(swaplock(pgdir)){
+    if(pgdir[PDX(va)] == old){
+      buddy_split((void*)KADDR(PTE_ADDR(old)));
+      rmaplock();
+      rmapsplit(PTE_ADDR(old), pgdir, va);
+      pgdir[PDX(va)] = PADDR(pgtab) | PTE_P | PTE_W | PTE_U;
+      rmapunlock();
+      pgtab = 0;
+    }
+    swapunlock();
+  }
+  if(pgtab){
+    kfree((char*)pgtab);
+    return 0;
+  }
+  vmcharge(pgdir, 0, -1);
+  if(pgdir == proc->pgdir)
+    lcr3(CR3(pgdir));
+  return 0;
+}
+
+// Swap out one page of pgdir, continuing from the clock hand.
+// Returns 0 if a frame was freed, -1 if none could be.
+static int
+evictfrom(pde_t *pgdir)
+{
+  pte_t *e, old;
+  uint va, size;
+  int slot;
+
+  for(;;){
+    if(!swaplock(pgdir))
+      return -1;
+    if((e = clockscan(pgdir, &va)) == 0){
+      swapunlock();
+      return -1;
+    }
+    // A write during the transfer sets PTE_D again, which tells us
+    // to keep the page.
+    *e &= ~PTE_D;
+    old = *e;
+    swapunlock();
+    if(pgdir == proc->pgdir)
+      lcr3(CR3(pgdir));
+
+    size = (old & PTE_PS) ? MAXPGSIZE : PGSIZE;
+    if((slot = swapalloc(size / PGSIZE)) < 0){
+      // No room for a whole huge page: evict its 4K pages instead.
+      if(size == PGSIZE || splithuge(pgdir, va, old) < 0)
+        return -1;
+      hand.va = va;
+      continue;
+    }
+    swapwrite(slot, (char*)KADDR(PTE_ADDR(old)), size / PGSIZE);
+    if(swaplock(pgdir)){
+      if((e = pageentry(pgdir, va, size)) != 0 &&
+         setpte(pgdir, va, e, old, SWAPENTRY(slot, old)) > 0){
+        swapunlock();
+        if(pgdir == proc->pgdir)
+          lcr3(CR3(pgdir));
+        kfree((char*)KADDR(PTE_ADDR(old)));
+        return 0;
+      }
+      swapunlock();
+    }
+    // Used or unmapped meanwhile.
+    swapfree(slot, size / PGSIZE);
+  }
+}
+
+// Free a frame of user memory by writing a page that has not been
+// used recently to swap.  The clock (second chance) algorithm sweeps
+// every address space that may be evicted (see swaplock() in
+// proc.c).  Returns 0 if the caller should retry its allocation, -1
+// if nothing could be evicted.
+int
+swapout(void)
+{
+  pde_t *pgdir;
+  int n, r;
+
+  if(swapbegin() < 0)
+    return 0;
+  r = -1;
+  // Two sweeps, so pages passed over once come round again.
+  for(n = 0; n < 2*NPROC && r < 0; n++){
+    if((pgdir = swapvictim(hand.slot)) != 0){
+      r = evictfrom(pgdir);
+      freevm(pgdir);
+    }
+    if(r < 0){
+      hand.slot = (hand.slot + 1) % NPROC;
+      hand.va = 0;
+    }
+  }
+  swapend();
+  return r;
+}
+
+// If page va of the current process is swapped out, read it back.
+// Returns 0 once it is present, 1 if it is not swapped out, or -1
+// if there is no memory for it.  Other threads may fault on the same
+// page at the same time; the first to install it wins.
+static int
+swapin(uint va)
+{
+  pde_t *pde;
+  pte_t *pte, *pgtab, e;
+  char *mem;
+  int i;
+
+  pde = &proc->pgdir[PDX(va)];
+  if(ISSWAPPED(*pde)){
+    // A huge page comes back whole if a 4M frame is free.
+    // Otherwise it becomes a page table of swapped-out 4K pages that come
+    // back one at a time as they are touched.
+    e = *pde;
+    if((mem = buddy_alloc(MAXPGSIZE)) != 0){
+      swapread(SWAPSLOT(e), mem, MAXPGSIZE / PGSIZE);
+      if(setpte(proc->pgdir, ROUNDDOWN(va, MAXSIZE), pde, e,
+                PADDR(mem) | (e & (PTE_W|PTE_U|PTE_PS)) | PTE_P | PTE_A) > 0)
+        swapfree(SWAPSLOT(e), MAXPGSIZE / PGSIZE);
+      else
+        kfree(mem);
+      return 0;
+    }
+    if((pgtab = (pte_t*)uvmalloc(PGSIZE)) == 0)
+      return -1;
+    for(i = 0; i < NPTENTRIES; i++)
+      pgtab[i] = hugepte(e, i);
+    if(cmpxchgpte(pde, e, PADDR(pgtab) | PTE_P | PTE_W | PTE_U) == e)
+      vmcharge(proc->pgdir, 0, -1);
+    else
+      kfree((char*)pgtab);
+    return 0;
+  }
+
+  if((pte = walkpgdir(proc->pgdir, (void*)va, 0)) == 0 || !ISSWAPPED(*pte))
+    return 1;
+  e = *pte;
+  if((mem = uvmalloc(PGSIZE)) == 0)
+    return -1;
+  swapread(SWAPSLOT(e), mem, 1);
+  if(setpte(proc->pgdir, va, pte, e, PADDR(mem) | (e & (PTE_W|PTE_U)) | PTE_P | PTE_A) > 0)
+    swapfree(SWAPSLOT(e), 1);
+  else
+    kfree(mem);
+  return 0;
+}
+
+// If page va of the current process is reserved by zerouvm(), back
+// it.  A read maps the zero page read-only, or the zero huge page for
+// a reserved 4M region; a write, or a read in a shared address space
+// (see vmunshare()), gets a private zeroed page, which also replaces
+// a zero page on the first write to it.  The huge heap's reservation
+// past the break is not backed until sbrk() reaches it.  Returns 0
+// once the access can be retried, 1 if va is not reserved, or -1 if
+// there is no memory for it.
+static int
+zerofault(uint va, int write)
+{
+  pde_t *pgdir, *pde;
+  pte_t *pte, e;
+  char *mem;
+
+  if(va >= proc->sz && va < (uint)proc->stack)
+    return 1;
+  pgdir = proc->pgdir;
+  if(vmshared(pgdir))
+    write = 1;
+  pde = &pgdir[PDX(va)];
+  e = *pde;
+  if((e & PTE_PS) && (ISZEROFILL(e) || zeromapped(e))){
+    if(!write){
+      if(!(e & PTE_P) &&
+         cmpxchgpte(pde, e, PADDR(zerohuge) | PTE_PS | PTE_U | PTE_P | PTE_A) == e)
+        zerocount(NPTENTRIES);
+      return 0;
+    }
+    if(vmcharge(pgdir, 0, 1) == 0){
+      if((mem = buddy_alloc(MAXPGSIZE)) != 0){
+        memset(mem, 0, MAXPGSIZE);
+        if(setpte(pgdir, ROUNDDOWN(va, MAXSIZE), pde, e,
+                  PADDR(mem) | PTE_PS | PTE_W | PTE_U | PTE_P | PTE_A) > 0){
+          if(e & PTE_P){
+            zerocount(-NPTENTRIES);
+            lcr3(CR3(pgdir));
+          }
+          return 0;
+        }
+        kfree(mem);
+      }
+      vmcharge(pgdir, 0, -1);
+    }
+    // No huge page to be had: go on with 4K pages.  Their page
+    // table may have to come from swapping something out.
+    if((mem = uvmalloc(PGSIZE)) == 0)
+      return -1;
+    if(*pde != e){
+      kfree(mem);
+      return 0;
+    }
+    splitpde(pgdir, va, (pte_t*)mem);
+    e = *pde;
+  }
+  if((e & (PTE_P|PTE_PS)) != PTE_P)
+    return 1;
+  pte = &((pte_t*)KADDR(PTE_ADDR(e)))[PTX(va)];
+  e = *pte;
+  if(!ISZEROFILL(e) && !zeromapped(e))
+    return 1;
+  if(!write){
+    if(!(e & PTE_P) && cmpxchgpte(pte, e, PADDR(zeropage) | PTE_U | PTE_P | PTE_A) == e)
+      zerocount(1);
+    return 0;
+  }
+  if((mem = uvmalloc(PGSIZE)) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  if(setpte(pgdir, va, pte, e, PADDR(mem) | PTE_W | PTE_U | PTE_P | PTE_A) <= 0){
+    kfree(mem);
+    return 0;
+  }
+  if(e & PTE_P){
+    zerocount(-1);
+    lcr3(CR3(pgdir));
+  }
+  return 0;
+}
+
+// On a write to merged page va of the current process, give it a
+// private copy.  Returns 0 once the write can be retried, or -1 if
+// va is not merged or there is no memory for the copy.
+static int
+ksmfault(uint va)
+{
+  pte_t *pte;
+
+  if((pte = pageentry(proc->pgdir, va, PGSIZE)) == 0 ||
+     (*pte & (PTE_P|PTE_SHR)) != (PTE_P|PTE_SHR) ||
+     unmerge(proc->pgdir, va, pte) < 0)
+    return -1;
+  lcr3(CR3(proc->pgdir));
+  return 0;
+}
+
+// Try to resolve a page fault at user address va in the current
+// process; err is the hardware error code.  Returns 0 if the
+// faulting access can be retried, -1 if the fault is fatal.
+int
+pagefault(uint va, uint err)
+{
+  int r, swappable;
+
+  // The only protection faults to resolve are writes to zero pages
+  // and merged pages.
+  if(va >= USERTOP || (err & (FEC_PR|FEC_WR)) == FEC_PR)
+    return -1;
+  va = (uint)PGROUNDDOWN(va);
+  // After a fault in user mode the kernel holds no pointers into
+  // user memory, so more pages may be evicted while this one loads.
+  swappable = proc->swappable;
+  if(err & FEC_U)
+    proc->swappable = 1;
+  if((r = swapin(va)) > 0)
+    r = zerofault(va, err & FEC_WR);
+  if(r > 0 && (err & FEC_PR))
+    r = ksmfault(va);
+  else if(r > 0)
+    r = userfaulthandle(va, err & FEC_WR);
+  proc->swappable = swappable;
+  return r;
+}
+
+// Fault in the pages holding user addresses [va, va+len) of the
+// current process, as a kernel write to them would.  System calls
+// use this before the kernel touches user memory, possibly under a
+// spinlock, where resolving a fault could not sleep.
+int
+prefault(uint va, uint len)
+{
+  pte_t e;
+  uint a;
+
+  if(len == 0)
+    return 0;
+  for(a = (uint)PGROUNDDOWN(va); a - (uint)PGROUNDDOWN(va) < len + va % PGSIZE;
+      a += PGSIZE){
+    e = uvaentry(proc->pgdir, a);
+    if((e & (PTE_P|PTE_W)) != (PTE_P|PTE_W) &&
+       pagefault(a, (e & PTE_P) ? FEC_WR|FEC_PR : FEC_WR) < 0)
+      return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,17 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// ksm npages nticks: merge identical pages, looking at npages pages
+// every nticks clock ticks.  ksm 0 1 stops merging.
+int
+main(int argc, char *argv[])
+{
+  if(argc != 3){
+    printf(2, "usage: ksm npages nticks\n");
+    exit();
+  }
+  if(ksmctl(atoi(argv[1]), atoi(argv[2])) < 0)
+    printf(2, "ksm: bad scan rate\n");
+  exit();
+}
@@ -7,12 +7,16 @@ USER_PROGS := \
 	grep\
 	init\
 	kill\
+	ksm\
 	ln\
 	ls\
+	memstat\
 	mkdir\
 	rm\
+	schedstat\
 	sh\
 	stressfs\
+	sysbench\
 	tester\
 	usertests\
 	wc\
@@ -26,7 +30,9 @@ USER_LIBS := \
 	ulib.o\
 	usys.o\
 	printf.o\
-	umalloc.o
+	umalloc.o\
+	uthread.o\
+	vdso.o
 
 USER_LIBS := $(addprefix user/, $(USER_LIBS))
 
@@ -0,0 +1,20 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "memstat.h"
+
+int
+main(int argc, char *argv[])
+{
+  struct memstat m;
+
+  if(memstat(&m) < 0){
+    printf(2, "memstat failed\n");
+    exit();
+  }
+  printf(1, "zero pages: %d pages mapped, %d KB saved\n",
+         m.zeropages, m.zeropages * 4);
+  printf(1, "merged pages: %d frames shared, %d KB saved, %d scans\n",
+         m.ksmshared, m.ksmsaved * 4, m.ksmscans);
+  exit();
+}
@@ -0,0 +1,25 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "schedstat.h"
+
+int
+main(int argc, char *argv[])
+{
+  struct schedstat s;
+  int l;
+
+  if(schedstat(&s) < 0){
+    printf(2, "schedstat failed\n");
+    exit();
+  }
+  for(l = 0; l < NMLFQ; l++)
+    printf(1, "level %d: %d runs, %d ticks, %d demoted\n",
+           l, s.runs[l], s.ticks[l], s.demotions[l]);
+  printf(1, "%d boosts, %d steals\n", s.boosts, s.steals);
+  printf(1, "class: %s\n", s.fair ? "fair" : "mlfq");
+  for(l = 0; l < s.ncpu; l++)
+    printf(1, "cpu%d: %d ticks idle\n", l, s.idle[l]);
+  exit();
+}
@@ -0,0 +1,42 @@
+// Time a null system call, getpid(), entered with int $T_SYSCALL
+// and, if the CPU has it, with sysenter.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "x86.h"
+
+#define N 100000
+
+static void
+bench(int mode, char *name)
+{
+  uint64 c0, c1, t0, t1;  // differences fit 32 bits for N calls
+  int i;
+
+  sysmode = mode;
+  t0 = nanotime();
+  c0 = rdtsc();
+  for(i = 0; i < N; i++)
+    getpid();
+  c1 = rdtsc();
+  t1 = nanotime();
+  printf(1, "%s: %d cycles, %d ns per call\n",
+         name, (uint)(c1 - c0) / N, (uint)(t1 - t0) / N);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int mode;
+
+  getpid();
+  mode = sysmode;
+  bench(1, "int");
+  if(mode == 2)
+    bench(2, "sysenter");
+  else
+    printf(1, "sysenter: not supported\n");
+  sysmode = mode;
+  exit();
+}
@@ -2,6 +2,23 @@
 #define _USER_H_
 
 struct stat;
+struct rlimit;
+struct memstat;
+struct schedstat;
+struct timespec;
+
+typedef struct {
+  volatile uint locked;
+} lock_t;
+
+// Sleeping locks and condition variables built on futexes.
+typedef struct {
+  volatile uint state;  // 0 unlocked, 1 locked, 2 locked with waiters
+} mutex_t;
+
+typedef struct {
+  volatile uint seq;    // bumped by every signal or broadcast
+} cond_t;
 
 // system calls
 int fork(void);
@@ -27,7 +44,27 @@ int sleep(int);
 int uptime(void);
 int getnextpid();
 int getprocstate(int pid, char* state, int n);
+int clone(void(*)(void*), void*, void*);
+int join(void**);
+int futex_wait(volatile uint*, int, int);
+int futex_wake(volatile uint*, int);
+int userfault(void*, uint);
+int userfault_copy(int, void*, void*, uint);
+int setrlimit(int, uint);
+int getrlimit(int, struct rlimit*);
+int memstat(struct memstat*);
+int ksmctl(int, int);
+int hugeheap(int);
+int nice(int);
+int schedstat(struct schedstat*);
+int setweight(int);
+int nanosleep(struct timespec*);
+int clock_gettime(int, struct timespec*);
+int pagectl(void*, int);
 
+// How system calls enter the kernel (usys.S): 0 not yet known,
+// 1 int $T_SYSCALL, 2 sysenter.
+extern int sysmode;
 
 // user library functions (ulib.c)
 int stat(char*, struct stat*);
@@ -43,5 +80,25 @@ void* malloc(uint);
 void free(void*);
 int atoi(const char*);
 
+// vDSO page readers (vdso.c), no system call
+uint vdso_uptime(void);
+int vdso_getpid(void);
+int vdso_getcpu(void);
+uint64 nanotime(void);
+
+// user thread library (uthread.c)
+int thread_create(void(*)(void*), void*);
+int thread_join(void);
+void lock_init(lock_t*);
+void lock_acquire(lock_t*);
+void lock_release(lock_t*);
+void mutex_init(mutex_t*);
+void mutex_lock(mutex_t*);
+void mutex_unlock(mutex_t*);
+void cond_init(cond_t*);
+void cond_wait(cond_t*, mutex_t*);
+void cond_signal(cond_t*);
+void cond_broadcast(cond_t*);
+
 #endif // _USER_H_
 
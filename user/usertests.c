@@ -5,6 +5,14 @@
 #include "fcntl.h"
 #include "syscall.h"
 #include "traps.h"
+#include "userfault.h"
+#include "rlimit.h"
+#include "memstat.h"
+#include "param.h"
+#include "schedstat.h"
+#include "time.h"
+#include "vdso.h"
+#include "pagectl.h"
 
 #define PAGE (4096)
 #define MAX_PROC_MEM (640 * 1024)
@@ -1237,6 +1245,973 @@ forktest(void)
   printf(1, "fork test OK\n");
 }
 
+// threads share memory, and each one is joined exactly once
+#define NTHREAD 4
+#define THREADLOOPS 1000
+
+lock_t threadlock;
+int threadcount;
+
+void
+threadworker(void *arg)
+{
+  int i;
+
+  for(i = 0; i < THREADLOOPS; i++){
+    lock_acquire(&threadlock);
+    threadcount += (int)arg;
+    lock_release(&threadlock);
+  }
+  exit();
+}
+
+void
+threadtest(void)
+{
+  int i;
+
+  printf(stdout, "thread test\n");
+  lock_init(&threadlock);
+  threadcount = 0;
+  for(i = 0; i < NTHREAD; i++){
+    if(thread_create(threadworker, (void*)1) < 0){
+      printf(stdout, "thread_create failed\n");
+      exit();
+    }
+  }
+  for(i = 0; i < NTHREAD; i++){
+    if(thread_join() < 0){
+      printf(stdout, "thread_join stopped early\n");
+      exit();
+    }
+  }
+  if(thread_join() != -1){
+    printf(stdout, "thread_join got too many\n");
+    exit();
+  }
+  if(threadcount != NTHREAD*THREADLOOPS){
+    printf(stdout, "thread test: count %d, expected %d\n",
+           threadcount, NTHREAD*THREADLOOPS);
+    exit();
+  }
+  printf(stdout, "thread test ok\n");
+}
+
+// exec() in a process with threads ends the other threads: the
+// last writer to the pipe is a thread left behind by exec
+int threadexecfd;
+
+void
+threadexecworker(void *arg)
+{
+  for(;;){
+    write(threadexecfd, "x", 1);
+    sleep(1);
+  }
+}
+
+void
+threadexectest(void)
+{
+  char *args[] = { "echo", 0 };
+  int fds[2], pid, n;
+  char c;
+
+  printf(stdout, "thread exec test\n");
+  if(pipe(fds) != 0){
+    printf(stdout, "pipe failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    close(fds[0]);
+    threadexecfd = fds[1];
+    if(thread_create(threadexecworker, 0) < 0){
+      printf(stdout, "thread_create failed\n");
+      exit();
+    }
+    close(fds[1]);
+    close(1);
+    exec("echo", args);
+    exit();
+  }
+  close(fds[1]);
+  n = 0;
+  while(n < 1000 && read(fds[0], &c, 1) == 1)
+    n++;
+  close(fds[0]);
+  wait();
+  if(n == 1000){
+    printf(stdout, "thread exec test: thread outlived exec\n");
+    exit();
+  }
+  printf(stdout, "thread exec test ok\n");
+}
+
+// futex-based mutexes and condition variables between threads
+mutex_t futexmutex;
+cond_t futexcond;
+int futexturn;
+
+void
+futexworker(void *arg)
+{
+  int i, me;
+
+  me = (int)arg;
+  for(i = 0; i < THREADLOOPS/10; i++){
+    mutex_lock(&futexmutex);
+    while(futexturn != me)
+      cond_wait(&futexcond, &futexmutex);
+    futexturn = (me + 1) % NTHREAD;
+    threadcount++;
+    cond_broadcast(&futexcond);
+    mutex_unlock(&futexmutex);
+  }
+  exit();
+}
+
+void
+futextest(void)
+{
+  volatile uint word;
+  int i;
+
+  printf(stdout, "futex test\n");
+  word = 1;
+  if(futex_wait(&word, 0, 0) != -1){
+    printf(stdout, "futex_wait slept on a stale value\n");
+    exit();
+  }
+  if(futex_wake(&word, 1) != 0){
+    printf(stdout, "futex_wake woke a phantom waiter\n");
+    exit();
+  }
+  if(futex_wait(&word, 1, 2) != -1){
+    printf(stdout, "futex_wait did not time out\n");
+    exit();
+  }
+
+  mutex_init(&futexmutex);
+  cond_init(&futexcond);
+  futexturn = 0;
+  threadcount = 0;
+  for(i = 0; i < NTHREAD; i++){
+    if(thread_create(futexworker, (void*)i) < 0){
+      printf(stdout, "thread_create failed\n");
+      exit();
+    }
+  }
+  for(i = 0; i < NTHREAD; i++){
+    if(thread_join() < 0){
+      printf(stdout, "thread_join stopped early\n");
+      exit();
+    }
+  }
+  if(threadcount != NTHREAD*(THREADLOOPS/10)){
+    printf(stdout, "futex test: count %d, expected %d\n",
+           threadcount, NTHREAD*(THREADLOOPS/10));
+    exit();
+  }
+  printf(stdout, "futex test ok\n");
+}
+
+// a thread resolves faults on a userfault-registered range
+int uffd;
+
+void
+userfaulthandler(void *src)
+{
+  struct uffdmsg msg;
+
+  if(read(uffd, &msg, sizeof(msg)) != sizeof(msg)){
+    printf(stdout, "userfault read failed\n");
+    exit();
+  }
+  if(userfault_copy(uffd, (void*)msg.addr, src, PAGE) < 0){
+    printf(stdout, "userfault_copy failed\n");
+    exit();
+  }
+  exit();
+}
+
+void
+userfaulttest(void)
+{
+  char *a, *p, *src;
+
+  printf(stdout, "userfault test\n");
+  a = sbrk(3*PAGE);
+  p = (char*)(((uint)a + PAGE - 1) & ~(PAGE - 1));
+  src = malloc(PAGE);
+  memset(src, 'u', PAGE);
+  p[PAGE + 10] = 'x';
+  if((uffd = userfault(p, 2*PAGE)) < 0){
+    printf(stdout, "userfault failed\n");
+    exit();
+  }
+  if(thread_create(userfaulthandler, src) < 0){
+    printf(stdout, "thread_create failed\n");
+    exit();
+  }
+  if(p[PAGE + 10] != 'u'){
+    printf(stdout, "userfault: wrong page contents\n");
+    exit();
+  }
+  if(thread_join() < 0){
+    printf(stdout, "thread_join failed\n");
+    exit();
+  }
+  close(uffd);
+  free(src);
+  printf(stdout, "userfault test ok\n");
+}
+
+// more processes than fit in physical memory together; their pages
+// go to swap and must come back intact.  Sized for the 128MB that
+// qemu gives the machine by default.
+#define NSWAPPROC 11
+#define SWAPMEM (12*1024*1024)
+
+void
+swaptest(void)
+{
+  int fd, fds[2], i, n, pid;
+  uint *p, j;
+  char c;
+
+  printf(stdout, "swap test\n");
+  if(pipe(fds) != 0){
+    printf(stdout, "pipe failed\n");
+    exit();
+  }
+  for(i = 0; i < NSWAPPROC; i++){
+    if((pid = fork()) < 0){
+      printf(stdout, "swap test: fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      close(fds[0]);
+      c = 'x';
+      if((p = (uint*)sbrk(SWAPMEM)) != (uint*)-1){
+        for(j = 0; j < SWAPMEM/4; j += PAGE/4)
+          p[j] = i ^ j;
+        // check once all the others have filled memory too; wait in
+        // sleep(), where pages can be swapped out
+        while((fd = open("swapgo", 0)) < 0)
+          sleep(10);
+        close(fd);
+        for(j = 0; j < SWAPMEM/4; j += PAGE/4)
+          if(p[j] != (i ^ j))
+            break;
+        if(j == SWAPMEM/4)
+          c = 'y';
+      }
+      write(fds[1], &c, 1);
+      exit();
+    }
+  }
+  close(fds[1]);
+  if((fd = open("swapgo", O_CREATE|O_RDWR)) < 0){
+    printf(stdout, "swap test: create failed\n");
+    exit();
+  }
+  close(fd);
+  // reap each child as it reports: a zombie keeps its memory, and
+  // zombies are not swapped out
+  n = 0;
+  while(read(fds[0], &c, 1) == 1){
+    if(c == 'y')
+      n++;
+    wait();
+  }
+  close(fds[0]);
+  unlink("swapgo");
+  if(n != NSWAPPROC){
+    printf(stdout, "swap test: %d of %d processes lost memory\n",
+           NSWAPPROC - n, NSWAPPROC);
+    exit();
+  }
+  printf(stdout, "swap test ok\n");
+}
+
+// per-process and process-tree memory limits
+void
+rlimittest(void)
+{
+  struct rlimit rl;
+  char *a;
+  int pid;
+
+  printf(stdout, "rlimit test\n");
+  pid = fork();
+  if(pid == 0){
+    if(getrlimit(RLIMIT_PAGES, &rl) < 0 || rl.limit != RLIM_INFINITY){
+      printf(stdout, "getrlimit failed\n");
+      exit();
+    }
+    if(setrlimit(RLIMIT_PAGES, rl.use + 8) < 0 ||
+       setrlimit(RLIMIT_PAGES, RLIM_INFINITY) == 0){
+      printf(stdout, "setrlimit failed\n");
+      exit();
+    }
+    if(sbrk(4*PAGE) == (char*)-1 || sbrk(8*PAGE) != (char*)-1){
+      printf(stdout, "page limit not enforced\n");
+      exit();
+    }
+    exit();
+  }
+  wait();
+
+  // without huge pages, a 4M-aligned 4M region comes as 4K pages
+  pid = fork();
+  if(pid == 0){
+    setrlimit(RLIMIT_HUGEPAGES, 0);
+    a = sbrk(0);
+    sbrk((4*1024*1024 - (uint)a % (4*1024*1024)) + 4*1024*1024);
+    a = sbrk(0);
+    a[-1] = 1;
+    if(getrlimit(RLIMIT_HUGEPAGES, &rl) < 0 || rl.use != 0){
+      printf(stdout, "huge page limit not enforced\n");
+      exit();
+    }
+    exit();
+  }
+  wait();
+
+  // a tree limit covers children forked afterwards
+  pid = fork();
+  if(pid == 0){
+    getrlimit(RLIMIT_PAGES, &rl);
+    if(setrlimit(RLIMIT_TREEPAGES, 2*rl.use + 64) < 0){
+      printf(stdout, "setrlimit tree failed\n");
+      exit();
+    }
+    pid = fork();
+    if(pid == 0){
+      if(sbrk(16*PAGE) == (char*)-1 || sbrk(128*PAGE) != (char*)-1)
+        printf(stdout, "tree limit not enforced\n");
+      exit();
+    }
+    wait();
+    exit();
+  }
+  wait();
+  printf(stdout, "rlimit test ok\n");
+}
+
+// untouched heap pages read as the shared zero pages
+void
+zeropagetest(void)
+{
+  struct memstat m0, m1, m2;
+  char *a, *b;
+  int i, sum, pid;
+
+  printf(stdout, "zero page test\n");
+  a = sbrk(0);
+  if((uint)a % PAGE)
+    sbrk(PAGE - (uint)a % PAGE);
+  memstat(&m0);
+  a = sbrk(8*PAGE);
+  sum = 0;
+  for(i = 0; i < 8; i++)
+    sum += a[i*PAGE];
+  memstat(&m1);
+  if(sum != 0 || m1.zeropages < m0.zeropages + 8){
+    printf(stdout, "zero pages not mapped\n");
+    exit();
+  }
+  a[3*PAGE] = 7;
+  memstat(&m2);
+  if(a[3*PAGE] != 7 || a[2*PAGE] != 0 || a[4*PAGE] != 0 ||
+     m2.zeropages != m1.zeropages - 1){
+    printf(stdout, "zero page not replaced on write\n");
+    exit();
+  }
+
+  // a child shares the zero pages, and writes its own copies
+  pid = fork();
+  if(pid == 0){
+    a[5*PAGE] = 1;
+    if(a[3*PAGE] != 7 || a[5*PAGE] != 1 || a[6*PAGE] != 0)
+      printf(stdout, "zero page wrong in child\n");
+    exit();
+  }
+  wait();
+  if(a[5*PAGE] != 0){
+    printf(stdout, "child wrote to zero page\n");
+    exit();
+  }
+  sbrk(-8*PAGE);
+
+  // a whole 4M region reads as the zero huge page
+  a = sbrk(0);
+  b = sbrk((4*1024*1024 - (uint)a % (4*1024*1024)) + 4*1024*1024);
+  if(b == (char*)-1){
+    printf(stdout, "sbrk failed\n");
+    exit();
+  }
+  b = sbrk(0) - 4*1024*1024;
+  memstat(&m1);
+  sum = b[0] + b[4*1024*1024 - 1];
+  memstat(&m2);
+  if(sum != 0 || m2.zeropages < m1.zeropages + 1024){
+    printf(stdout, "zero huge page not mapped\n");
+    exit();
+  }
+  b[PAGE] = 1;
+  if(b[PAGE] != 1 || b[0] != 0){
+    printf(stdout, "zero huge page not replaced on write\n");
+    exit();
+  }
+  sbrk(a - sbrk(0));
+  printf(stdout, "zero page test ok\n");
+}
+
+// past the hugeheap() threshold, sbrk() grows the heap up to a huge
+// page boundary, so small steps still end up in huge pages
+void
+hugeheaptest(void)
+{
+  struct memstat m1, m2;
+  struct rlimit rl;
+  char *a, *b;
+  int sum, pid;
+
+  printf(stdout, "huge heap test\n");
+  pid = fork();
+  if(pid == 0){
+    if(hugeheap(0) != -1){
+      printf(stdout, "hugeheap not off by default\n");
+      exit();
+    }
+    a = sbrk(0);
+    b = a + (4*1024*1024 - (uint)a % (4*1024*1024)) % (4*1024*1024);
+    while(sbrk(0) < b + 4*1024*1024){
+      if(sbrk(3*PAGE + 5) == (char*)-1){
+        printf(stdout, "sbrk failed\n");
+        exit();
+      }
+    }
+    memstat(&m1);
+    sum = b[0] + b[4*1024*1024 - 1];
+    memstat(&m2);
+    if(sum != 0 || m2.zeropages < m1.zeropages + 1024){
+      printf(stdout, "heap not grown in huge pages\n");
+      exit();
+    }
+    // the reservation past the break cannot be touched, and goes
+    // when the heap shrinks
+    a = sbrk(PAGE) + 2*PAGE;
+    pid = fork();
+    if(pid == 0){
+      printf(stdout, "oops could read %x = %x past the break\n", a, *a);
+      exit();
+    }
+    wait();
+    getrlimit(RLIMIT_PAGES, &rl);
+    sum = rl.use;
+    sbrk(-PAGE);
+    getrlimit(RLIMIT_PAGES, &rl);
+    if(rl.use > sum - 1000){
+      printf(stdout, "reservation kept after shrink: %d pages, was %d\n",
+             rl.use, sum);
+      exit();
+    }
+    if(hugeheap(-1) != 0)
+      printf(stdout, "hugeheap threshold lost\n");
+    exit();
+  }
+  wait();
+  printf(stdout, "huge heap test ok\n");
+}
+
+// nice() stays within the priority levels and is inherited, and a
+// process that keeps the CPU has its ticks counted
+void
+nicetest(void)
+{
+  struct schedstat s0, s1;
+  int pid, t, l, n0, n1;
+
+  printf(stdout, "nice test\n");
+  pid = fork();
+  if(pid == 0){
+    if(nice(0) != 0 || nice(1) != 1 || nice(100) != NMLFQ-1 ||
+       nice(-100) != 0){
+      printf(stdout, "nice out of range\n");
+      exit();
+    }
+    nice(2);
+    pid = fork();
+    if(pid == 0){
+      if(nice(0) != 2)
+        printf(stdout, "nice not inherited\n");
+      exit();
+    }
+    wait();
+    exit();
+  }
+  wait();
+
+  schedstat(&s0);
+  t = uptime();
+  while(uptime() < t + 5)
+    ;
+  schedstat(&s1);
+  n0 = n1 = 0;
+  for(l = 0; l < NMLFQ; l++){
+    n0 += s0.ticks[l];
+    n1 += s1.ticks[l];
+  }
+  if(n1 < n0 + 3){
+    printf(stdout, "ticks not counted\n");
+    exit();
+  }
+  printf(stdout, "nice test ok\n");
+}
+
+// setweight() keeps the weight in range and fork() passes it on
+void
+weighttest(void)
+{
+  int pid;
+
+  printf(stdout, "weight test\n");
+  pid = fork();
+  if(pid == 0){
+    if(setweight(0) != 1024 || setweight(3000) != 1024 ||
+       setweight(1 << 30) != 3000 || setweight(2048) != 64*1024){
+      printf(stdout, "setweight wrong\n");
+      exit();
+    }
+    pid = fork();
+    if(pid == 0){
+      if(setweight(0) != 2048)
+        printf(stdout, "weight not inherited\n");
+      exit();
+    }
+    wait();
+    exit();
+  }
+  wait();
+  printf(stdout, "weight test ok\n");
+}
+
+// sleep() lasts as long as asked and not much longer, also past the
+// first level of the timer wheel (256 ticks), and a futex timeout
+// does too.  The upper bound leaves room for a loaded emulator.
+void
+sleeptest(void)
+{
+  static int n[4] = { 1, 7, 40, 300 };
+  uint word;
+  int i, t, pid;
+
+  printf(stdout, "sleep test\n");
+  for(i = 0; i < 4; i++){
+    pid = fork();
+    if(pid == 0){
+      t = uptime();
+      sleep(n[i]);
+      t = uptime() - t;
+      if(t < n[i] || t > n[i] + n[i]/2 + 50)
+        printf(stdout, "sleep(%d) took %d ticks\n", n[i], t);
+      exit();
+    }
+  }
+  word = 0;
+  t = uptime();
+  if(futex_wait(&word, 0, 20) != -1 || uptime() - t < 20){
+    printf(stdout, "futex timeout wrong\n");
+    exit();
+  }
+  for(i = 0; i < 4; i++)
+    wait();
+  printf(stdout, "sleep test ok\n");
+}
+
+// nanosleep() sleeps at least as long as asked, and short sleeps
+// take no more than a few ticks even without a tickless clock.  The
+// upper bounds leave room for a loaded emulator.
+void
+nanosleeptest(void)
+{
+  struct timespec ts;
+  int i, t;
+
+  printf(stdout, "nanosleep test\n");
+  ts.tv_sec = 0;
+  ts.tv_nsec = 1000000000;
+  if(nanosleep(&ts) != -1){
+    printf(stdout, "nanosleep accepted tv_nsec 1000000000\n");
+    exit();
+  }
+  ts.tv_nsec = 250000000;
+  t = uptime();
+  if(nanosleep(&ts) != 0){
+    printf(stdout, "nanosleep failed\n");
+    exit();
+  }
+  t = uptime() - t;
+  if(t < 25 || t > 100){
+    printf(stdout, "nanosleep(250ms) took %d ticks\n", t);
+    exit();
+  }
+  ts.tv_nsec = 500000;
+  t = uptime();
+  for(i = 0; i < 20; i++)
+    nanosleep(&ts);
+  t = uptime() - t;
+  if(t > 100){
+    printf(stdout, "20 nanosleep(500us) took %d ticks\n", t);
+    exit();
+  }
+  printf(stdout, "nanosleep test ok\n");
+}
+
+// clock_gettime() never goes back, and roughly agrees with the
+// ticks: sleep(20) lasts at least 19 tick periods, plus however long
+// it takes to run again, and the TSC calibration may be a little off
+void
+clocktest(void)
+{
+  struct timespec ts;
+  uint64 t0, t1;
+  uint ms;
+  int i;
+
+  printf(stdout, "clock test\n");
+  if(clock_gettime(0, &ts) != -1){
+    printf(stdout, "clock_gettime accepted clock 0\n");
+    exit();
+  }
+  t0 = nanotime();
+  for(i = 0; i < 1000; i++){
+    t1 = nanotime();
+    if(t1 < t0){
+      printf(stdout, "clock went back\n");
+      exit();
+    }
+    t0 = t1;
+  }
+  sleep(20);
+  t1 = nanotime();
+  ms = (uint)(t1 - t0) / 1000000;
+  if(ms < 150 || ms > 1000){
+    printf(stdout, "sleep(20) took %d ms\n", ms);
+    exit();
+  }
+  printf(stdout, "clock test ok\n");
+}
+
+// the vDSO page agrees with the system calls, and is read-only.  A
+// loaded emulator may preempt between the two readings, so the time
+// bounds are loose.
+void
+vdsotest(void)
+{
+  struct timespec ts;
+  uint64 t0, t1;
+  int pid, t;
+
+  printf(stdout, "vdso test\n");
+  pid = fork();
+  if(pid == 0){
+    if(vdso_getpid() != getpid())
+      printf(stdout, "vdso pid %d, getpid %d\n", vdso_getpid(), getpid());
+    if(vdso_getcpu() < 0 || vdso_getcpu() >= NCPU)
+      printf(stdout, "vdso cpu %d\n", vdso_getcpu());
+    t = uptime();
+    if(vdso_uptime() - t > 5)
+      printf(stdout, "vdso ticks %d, uptime %d\n", vdso_uptime(), t);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    t0 = (uint64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    t1 = nanotime();
+    if(t1 < t0 || t1 - t0 > 100000000)
+      printf(stdout, "vdso time %d ns off\n", (int)(t1 - t0));
+    exit();
+  }
+  wait();
+  pid = fork();
+  if(pid == 0){
+    ((struct vdso*)VDSO)->ticks = 0;
+    printf(stdout, "wrote the vdso page\n");
+    exit();
+  }
+  wait();
+  printf(stdout, "vdso test ok\n");
+}
+
+// system calls work the same through int $T_SYSCALL and sysenter
+void
+sysmodetest(void)
+{
+  int fds[2], mode, m, pid;
+  char c;
+
+  printf(stdout, "sysmode test\n");
+  getpid();
+  mode = sysmode;
+  for(m = 1; m <= mode; m++){
+    sysmode = m;
+    if(getpid() != vdso_getpid()){
+      printf(stdout, "sysmode %d: getpid %d, vdso %d\n", m, getpid(), vdso_getpid());
+      exit();
+    }
+    if(pipe(fds) != 0){
+      printf(stdout, "sysmode %d: pipe failed\n", m);
+      exit();
+    }
+    if(write(fds[1], "x", 1) != 1 || read(fds[0], &c, 1) != 1 || c != 'x'){
+      printf(stdout, "sysmode %d: pipe read/write failed\n", m);
+      exit();
+    }
+    close(fds[0]);
+    close(fds[1]);
+    pid = fork();
+    if(pid < 0){
+      printf(stdout, "sysmode %d: fork failed\n", m);
+      exit();
+    }
+    if(pid == 0){
+      if(sysmode != m)
+        printf(stdout, "sysmode %d: child has %d\n", m, sysmode);
+      exit();
+    }
+    if(wait() != pid){
+      printf(stdout, "sysmode %d: wait failed\n", m);
+      exit();
+    }
+  }
+  sysmode = mode;
+  printf(stdout, "sysmode test ok (%s)\n", mode == 2 ? "sysenter" : "int");
+}
+
+// pagectl() moves the frame under a page through the reverse map,
+// keeping its contents, or drops it so that the next touch faults
+void
+rmaptest(void)
+{
+  char *a, *b;
+  int i, pid;
+
+  printf(stdout, "rmap test\n");
+  a = sbrk(0);
+  if((uint)a % PAGE)
+    sbrk(PAGE - (uint)a % PAGE);
+  a = sbrk(2*PAGE);
+  for(i = 0; i < 2*PAGE; i++)
+    a[i] = i % 199;
+  if(pagectl(a, PAGE_MOVE) < 0 || pagectl(a + PAGE, PAGE_MOVE) < 0){
+    printf(stdout, "pagectl move failed\n");
+    exit();
+  }
+  for(i = 0; i < 2*PAGE; i++)
+    if((uchar)a[i] != i % 199){
+      printf(stdout, "moved page wrong\n");
+      exit();
+    }
+  a[1] = 7;
+  if(pagectl(a, 0) != -1 || pagectl(a + 2*PAGE, PAGE_MOVE) != -1){
+    printf(stdout, "pagectl took a bad request\n");
+    exit();
+  }
+
+  pid = fork();
+  if(pid == 0){
+    if(pagectl(a + PAGE, PAGE_DROP) < 0){
+      printf(stdout, "pagectl drop failed\n");
+      exit();
+    }
+    printf(stdout, "oops could read %x = %x after drop\n", a + PAGE, a[PAGE]);
+    exit();
+  }
+  wait();
+  if(a[1] != 7 || (uchar)a[PAGE + 1] != (PAGE + 1) % 199){
+    printf(stdout, "drop in child changed parent\n");
+    exit();
+  }
+  sbrk(-2*PAGE);
+
+  // a huge page moves as a whole
+  pid = fork();
+  if(pid == 0){
+    hugeheap(0);
+    a = sbrk(0);
+    b = a + (4*1024*1024 - (uint)a % (4*1024*1024)) % (4*1024*1024);
+    if(sbrk(b + 4*1024*1024 - a) == (char*)-1){
+      printf(stdout, "sbrk failed\n");
+      exit();
+    }
+    for(i = 0; i < 4*1024*1024; i += PAGE)
+      b[i] = i / PAGE;
+    if(pagectl(b, PAGE_MOVE) < 0){
+      printf(stdout, "pagectl huge move failed\n");
+      exit();
+    }
+    for(i = 0; i < 4*1024*1024; i += PAGE)
+      if(b[i] != (char)(i / PAGE)){
+        printf(stdout, "moved huge page wrong\n");
+        exit();
+      }
+    exit();
+  }
+  wait();
+  printf(stdout, "rmap test ok\n");
+}
+
+// identical pages are merged, and copied again when written
+void
+ksmtest(void)
+{
+  struct memstat m0, m;
+  char *a;
+  int i, j, pid;
+
+  printf(stdout, "ksm test\n");
+  a = sbrk(0);
+  if((uint)a % PAGE)
+    sbrk(PAGE - (uint)a % PAGE);
+  a = sbrk(16*PAGE);
+  for(i = 0; i < 16; i++)
+    for(j = 0; j < PAGE; j++)
+      a[i*PAGE + j] = j % 251;
+  memstat(&m0);
+  ksmctl(64, 1);
+  for(i = 0; i < 200; i++){
+    memstat(&m);
+    if(m.ksmsaved >= m0.ksmsaved + 15)
+      break;
+    sleep(1);
+  }
+  ksmctl(0, 1);
+  if(m.ksmsaved < m0.ksmsaved + 15){
+    printf(stdout, "pages not merged\n");
+    exit();
+  }
+  for(i = 0; i < 16; i++)
+    for(j = 0; j < PAGE; j++)
+      if((uchar)a[i*PAGE + j] != j % 251){
+        printf(stdout, "merged page wrong\n");
+        exit();
+      }
+
+  a[3*PAGE + 1] = 0;
+  if(a[3*PAGE + 1] != 0 || a[4*PAGE + 1] != 1 || a[3*PAGE + 2] != 2){
+    printf(stdout, "merged page not copied on write\n");
+    exit();
+  }
+  pid = fork();
+  if(pid == 0){
+    a[5*PAGE + 1] = 0;
+    if(a[6*PAGE + 1] != 1 || a[3*PAGE + 1] != 0)
+      printf(stdout, "merged page wrong in child\n");
+    exit();
+  }
+  wait();
+  if(a[5*PAGE + 1] != 1){
+    printf(stdout, "child wrote to merged page\n");
+    exit();
+  }
+  sbrk(-16*PAGE);
+  printf(stdout, "ksm test ok\n");
+}
+
+// teardown and fork walk only the mapped regions, and page tables
+// emptied by sbrk come back clean
+void
+regiontest(void)
+{
+  struct rlimit r0, r1;
+  char *a, *top;
+  int pid, i;
+
+  printf(stdout, "region test\n");
+  getrlimit(RLIMIT_PAGES, &r0);
+  a = sbrk(0);
+  top = sbrk(6*1024*1024);
+  if(top == (char*)-1){
+    printf(stdout, "sbrk failed\n");
+    exit();
+  }
+  top = sbrk(0);
+  for(i = 1; i <= 4; i++)
+    top[-i*PAGE] = i;
+  pid = fork();
+  if(pid == 0){
+    getrlimit(RLIMIT_PAGES, &r1);
+    for(i = 1; i <= 4; i++)
+      if(top[-i*PAGE] != i)
+        printf(stdout, "region not copied to child\n");
+    if(r1.use < r0.use + (6*1024*1024)/PAGE)
+      printf(stdout, "child charged %d pages, parent %d\n", r1.use, r0.use);
+    exit();
+  }
+  wait();
+  sbrk(a - sbrk(0));
+  getrlimit(RLIMIT_PAGES, &r1);
+  if(r1.use != r0.use){
+    printf(stdout, "pages still charged after shrink\n");
+    exit();
+  }
+  top = sbrk(6*1024*1024);
+  top = sbrk(0);
+  for(i = 1; i <= 4; i++){
+    if(top[-i*PAGE] != 0){
+      printf(stdout, "stale page after regrow\n");
+      exit();
+    }
+  }
+  sbrk(a - sbrk(0));
+  printf(stdout, "region test ok\n");
+}
+
+// Load v into every lane of xmm0 and check that it is still there
+// after giving up the CPU a few times.
+static int
+ssecheck(uint v)
+{
+  uint w;
+  int i;
+
+  asm volatile("movd %0, %%xmm0; pshufd $0, %%xmm0, %%xmm0" : : "r" (v));
+  for(i = 0; i < 10; i++){
+    sleep(1);
+    asm volatile("pshufd $0x39, %%xmm0, %%xmm0; movd %%xmm0, %0" : "=r" (w));
+    if(w != v)
+      return -1;
+  }
+  return 0;
+}
+
+// each process keeps its own SSE registers
+void
+ssetest(void)
+{
+  int pid;
+
+  printf(stdout, "sse test\n");
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "fork failed\n");
+    exit();
+  }
+  if(ssecheck(pid == 0 ? 0x11111111 : 0x22222222) < 0){
+    printf(stdout, "sse registers lost in %s\n", pid == 0 ? "child" : "parent");
+    exit();
+  }
+  if(pid == 0)
+    exit();
+  wait();
+  printf(stdout, "sse test ok\n");
+}
+
 void
 sbrktest(void)
 {
@@ -1519,6 +2494,25 @@ main(int argc, char *argv[])
   dirfile();
   iref();
   forktest();
+  threadtest();
+  threadexectest();
+  futextest();
+  userfaulttest();
+  swaptest();
+  rlimittest();
+  zeropagetest();
+  hugeheaptest();
+  nicetest();
+  weighttest();
+  sleeptest();
+  nanosleeptest();
+  clocktest();
+  vdsotest();
+  sysmodetest();
+  ksmtest();
+  rmaptest();
+  regiontest();
+  ssetest();
   bigdir(); // slow
 
   exectest();
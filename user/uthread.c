@@ -0,0 +1,141 @@
+// User-level threads on top of the clone() and join() system calls.
+// Every thread runs on its own one-page stack taken from malloc().
+// Also spin locks, and mutexes and condition variables that sleep
+// with futex_wait() and futex_wake().
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "x86.h"
+
+#define PGSIZE 4096
+
+// Start fn(arg) in a new thread sharing this address space.
+// Returns the thread's pid, or -1 on error.
+int
+thread_create(void (*fn)(void*), void *arg)
+{
+  void *mem, *stack;
+  int pid;
+
+  // clone() wants a page-aligned stack, so over-allocate and
+  // remember the malloc() pointer in the lowest word of the page,
+  // which the thread only reaches if it overflows its stack.
+  if((mem = malloc(2*PGSIZE)) == 0)
+    return -1;
+  stack = (void*)(((uint)mem + PGSIZE - 1) & ~(PGSIZE - 1));
+  *(void**)stack = mem;
+  if((pid = clone(fn, arg, stack)) < 0)
+    free(mem);
+  return pid;
+}
+
+// Wait for one of this process's threads to exit and free its
+// stack.  Returns the thread's pid, or -1 if there are none.
+int
+thread_join(void)
+{
+  void *stack;
+  int pid;
+
+  if((pid = join(&stack)) < 0)
+    return -1;
+  free(*(void**)stack);
+  return pid;
+}
+
+// Spin locks for threads.  Use them around malloc(), which is not
+// thread safe.
+void
+lock_init(lock_t *lk)
+{
+  lk->locked = 0;
+}
+
+void
+lock_acquire(lock_t *lk)
+{
+  while(xchg(&lk->locked, 1) != 0)
+    ;
+}
+
+void
+lock_release(lock_t *lk)
+{
+  xchg(&lk->locked, 0);
+}
+
+// Mutexes that sleep in the kernel when contended.  Locking and
+// unlocking an uncontended mutex never enters the kernel.
+void
+mutex_init(mutex_t *m)
+{
+  m->state = 0;
+}
+
+void
+mutex_lock(mutex_t *m)
+{
+  uint c;
+
+  if((c = cmpxchg(&m->state, 0, 1)) == 0)
+    return;
+  // Mark the mutex contended so the holder wakes us on unlock.
+  if(c != 2)
+    c = xchg(&m->state, 2);
+  while(c != 0){
+    futex_wait(&m->state, 2, 0);
+    c = xchg(&m->state, 2);
+  }
+}
+
+void
+mutex_unlock(mutex_t *m)
+{
+  if(xchg(&m->state, 0) == 2)
+    futex_wake(&m->state, 1);
+}
+
+// Condition variables.  A waiter sleeps until the sequence number
+// moves past the value it saw before releasing the mutex.
+void
+cond_init(cond_t *c)
+{
+  c->seq = 0;
+}
+
+static void
+cond_bump(cond_t *c)
+{
+  uint seq;
+
+  do {
+    seq = c->seq;
+  } while(cmpxchg(&c->seq, seq, seq + 1) != seq);
+}
+
+void
+cond_wait(cond_t *c, mutex_t *m)
+{
+  uint seq;
+
+  seq = c->seq;
+  mutex_unlock(m);
+  futex_wait(&c->seq, seq, 0);
+  mutex_lock(m);
+}
+
+void
+cond_signal(cond_t *c)
+{
+  cond_bump(c);
+  futex_wake(&c->seq, 1);
+}
+
+void
+cond_broadcast(cond_t *c)
+{
+  cond_bump(c);
+  futex_wake(&c->seq, NPROC);
+}
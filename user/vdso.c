@@ -0,0 +1,55 @@
+// Readers of the vDSO page (include/vdso.h), which the kernel maps
+// read-only at VDSO in every process.
+
+#include "types.h"
+#include "param.h"
+#include "user.h"
+#include "x86.h"
+#include "vdso.h"
+
+#define V ((struct vdso*)VDSO)
+
+// Like uptime().
+uint
+vdso_uptime(void)
+{
+  return V->ticks;
+}
+
+// Like getpid(): %fs selects the entry of the CPU we run on, whose
+// pid is ours while we run.
+int
+vdso_getpid(void)
+{
+  int pid;
+
+  asm volatile("movl %%fs:%c1, %0"
+               : "=r" (pid) : "i" (__builtin_offsetof(struct vdsocpu, pid)));
+  return pid;
+}
+
+// The CPU we are running on, which may have changed by the time the
+// caller looks at it.
+int
+vdso_getcpu(void)
+{
+  int c;
+
+  asm volatile("movl %%fs:%c1, %0"
+               : "=r" (c) : "i" (__builtin_offsetof(struct vdsocpu, cpu)));
+  return c;
+}
+
+// Nanoseconds since boot, as clock_gettime(CLOCK_MONOTONIC) gives
+// them, for timing things.
+uint64
+nanotime(void)
+{
+  uint64 d;
+
+  if(V->nsmult == 0)
+    return (uint64)V->ticks * (1000000000 / HZ);
+  d = rdtsc() - V->tscboot;
+  return ((uint64)(uint)d * V->nsmult >> V->nsshift) +
+         ((uint64)(uint)(d >> 32) * V->nsmult << (32 - V->nsshift));
+}